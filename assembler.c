@@ -0,0 +1,971 @@
+#include "assembler.h"
+#include "disasembler.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ASM_HASH_SIZE 1024
+#define ASM_KEY_LEN 16
+#define ASM_MAX_FORMS 8
+#define ASM_MAX_VARIANTS 2
+#define ASM_LINE_LEN 256
+#define ROUNDTRIP_MAX_REPORTS 16
+
+/**
+ * @brief An operand of a template
+ * @param field char 0 for a literal (dx, 03)
+ * @param forms char[3] the operand form letters it takes
+ * @param reg signed char register of a literal, -1 for a number
+ * @param value unsigned char number of a literal
+ */
+typedef struct AsmSlotStruct {
+    char field;
+    char forms[3];
+    signed char reg;
+    unsigned char value;
+} AsmSlot;
+
+/**
+ * @brief A mnemonic of a type, with the field it fixes (movsb : w = 0)
+ * @param name char[ASM_MNEMONIC_LEN]
+ * @param field char 'w', 'z' or 0
+ * @param value char
+ */
+typedef struct AsmVariantStruct {
+    char name[ASM_MNEMONIC_LEN];
+    char field;
+    char value;
+} AsmVariant;
+
+/**
+ * @brief A codeFormat compiled once for encoding
+ */
+typedef struct EncodePlanStruct {
+    int numSlots;
+    AsmSlot slots[MAX_OPERANDS];
+    int numVariants;
+    AsmVariant variants[ASM_MAX_VARIANTS];
+    const char *parts[MAX_INSTRUCT_LEN + 1];
+    FieldMask w, W, d, r, s, c, z, x;
+    uint16_t opcodeBits;     // the 0 / 1 bits of the opcode
+    unsigned char opcodeLen; // in bytes
+    signed char swapR, swapRS;
+} EncodePlan;
+
+/**
+ * @brief A way to encode a mnemonic and operand form
+ * @param type uint8_t
+ * @param variant uint8_t
+ * @param swap uint8_t d = 1, the r/m and reg operands exchanged
+ */
+typedef struct AsmFormStruct {
+    uint8_t type;
+    uint8_t variant;
+    uint8_t swap;
+} AsmForm;
+
+typedef struct AsmBucketStruct {
+    char key[ASM_KEY_LEN];
+    int count;
+    AsmForm forms[ASM_MAX_FORMS];
+} AsmBucket;
+
+static EncodePlan plans[NUM_OF_INSTRUCT_TYPES];
+static AsmBucket buckets[ASM_HASH_SIZE];
+static pthread_once_t plansOnce = PTHREAD_ONCE_INIT;
+
+// r/m of a base and an index register, REG_NONE is 0
+static const signed char eaOf[3][3] = {
+    {EA_DIRECT, 4, 5}, // no base : -, si, di
+    {7, 0, 1},         // bx
+    {6, 2, 3},         // bp
+};
+
+/* --- PLANS --- */
+
+static int findRegister(const char *name, int *reg, int *wide)
+{
+    for (int w = 0; w < 2; ++w) {
+        for (int r = 0; r < 8; ++r) {
+            if (strncmp(name, regNames[w][r], 2) == 0) {
+                *reg = r;
+                *wide = w;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int findSegment(const char *name)
+{
+    for (int s = 0; s < 4; ++s)
+        if (strncmp(name, segNames[s], 2) == 0)
+            return s;
+    return -1;
+}
+
+static void compileSlot(AsmSlot *slot, const char *op, size_t len)
+{
+    const char *dollar = memchr(op, '$', len);
+    slot->reg = -1;
+    slot->field = dollar ? dollar[1] : 0;
+    switch (slot->field) {
+    case 'R':
+        strcpy(slot->forms, "RM");
+        break;
+    case 'r':
+    case 'w':
+        strcpy(slot->forms, "R");
+        break;
+    case 's':
+        strcpy(slot->forms, "S");
+        break;
+    case 'D':
+        strcpy(slot->forms, "I");
+        break;
+    case 'a':
+        strcpy(slot->forms, "M");
+        break;
+    case 'o':
+        strcpy(slot->forms, "F");
+        break;
+    case 'c':
+        strcpy(slot->forms, "TR");
+        break;
+    case 0: {
+        int reg, wide;
+        if (findRegister(op, &reg, &wide)) {
+            slot->reg = reg;
+            strcpy(slot->forms, "R");
+        } else {
+            slot->value = strtoul(op, NULL, 16);
+            strcpy(slot->forms, "T");
+        }
+        break;
+    }
+    default: // P p i
+        strcpy(slot->forms, "T");
+        break;
+    }
+}
+
+static void addVariant(EncodePlan *plan, const char *name, size_t len, const char *suffix, char field, char value)
+{
+    AsmVariant *v = plan->variants + plan->numVariants++;
+    memcpy(v->name, name, len);
+    strcpy(v->name + len, suffix);
+    v->field = field;
+    v->value = value;
+}
+
+static unsigned int hashKey(const char *key)
+{
+    unsigned int h = 2166136261u;
+    for (; *key; ++key)
+        h = (h ^ (unsigned char)*key) * 16777619u;
+    return h;
+}
+
+static AsmBucket *findBucket(const char *key, int insert)
+{
+    for (unsigned int i = hashKey(key) & (ASM_HASH_SIZE - 1);; i = (i + 1) & (ASM_HASH_SIZE - 1)) {
+        if (buckets[i].key[0] == '\0') {
+            if (!insert)
+                return NULL;
+            strcpy(buckets[i].key, key);
+            return buckets + i;
+        }
+        if (strcmp(buckets[i].key, key) == 0)
+            return buckets + i;
+    }
+}
+
+static int makeKey(char *key, const char *mnemonic, const char *forms, int n)
+{
+    size_t len = strlen(mnemonic);
+    if (len + 2 + n > ASM_KEY_LEN)
+        return 1;
+    memcpy(key, mnemonic, len);
+    key[len] = ' ';
+    memcpy(key + len + 1, forms, n);
+    key[len + 1 + n] = '\0';
+    return 0;
+}
+
+// every combination of the forms the slots take, in operand order
+static void insertForms(int t, int variant, int swap)
+{
+    const EncodePlan *plan = plans + t;
+    int order[MAX_OPERANDS] = {0, 1, 2};
+    if (swap) {
+        order[(int)plan->swapR] = plan->swapRS;
+        order[(int)plan->swapRS] = plan->swapR;
+    }
+
+    int combos = 1;
+    for (int i = 0; i < plan->numSlots; ++i)
+        combos *= strlen(plan->slots[i].forms);
+    for (int combo = 0; combo < combos; ++combo) {
+        char forms[MAX_OPERANDS], key[ASM_KEY_LEN];
+        for (int i = 0, rest = combo; i < plan->numSlots; ++i) {
+            const char *slotForms = plan->slots[order[i]].forms;
+            int n = strlen(slotForms);
+            forms[i] = slotForms[rest % n];
+            rest /= n;
+        }
+        if (makeKey(key, plan->variants[variant].name, forms, plan->numSlots) != 0)
+            continue;
+        AsmBucket *bucket = findBucket(key, 1);
+        if (bucket->count < ASM_MAX_FORMS) {
+            AsmForm form = {t, variant, swap};
+            bucket->forms[bucket->count++] = form;
+        }
+    }
+}
+
+static void compilePlan(int t)
+{
+    const InstructionType *type = instructionTypes + t;
+    EncodePlan *plan = plans + t;
+    splitCodeFormatTo(type, plan->parts);
+
+    plan->w = compileField(type, 'w');
+    plan->W = compileField(type, 'W');
+    plan->d = compileField(type, 'd');
+    plan->r = compileField(type, 'r');
+    plan->s = compileField(type, 's');
+    plan->c = compileField(type, 'c');
+    plan->z = compileField(type, 'z');
+    plan->x = compileField(type, 'x');
+    for (const char *a = type->codeFormat; *a && *a != '('; ++a)
+        plan->opcodeBits = plan->opcodeBits << 1 | (*a == '1');
+    plan->opcodeLen = opcodeLength(type);
+
+    const char *p = type->printFormat;
+    const char *space = strchr(p, ' ');
+    size_t nameLen = space ? (size_t)(space - p) : strlen(p);
+    plan->swapR = plan->swapRS = -1;
+    for (const char *op = space ? space + 1 : NULL; op && plan->numSlots < MAX_OPERANDS;) {
+        const char *end = strstr(op, ", ");
+        size_t len = end ? (size_t)(end - op) : strlen(op);
+        AsmSlot *slot = plan->slots + plan->numSlots;
+        compileSlot(slot, op, len);
+        if (slot->field == 'R')
+            plan->swapR = plan->numSlots;
+        if (slot->field == 'r' || slot->field == 's')
+            plan->swapRS = plan->numSlots;
+        ++plan->numSlots;
+        op = end ? end + 2 : NULL;
+    }
+
+    // the as86 spelling, see outMnemonic in syntax.c
+    if (plan->z.div) {
+        addVariant(plan, "rep", 3, "", 'z', 1);
+        addVariant(plan, "repnz", 5, "", 'z', 0);
+    } else if (farTransfer(type)) {
+        addVariant(plan, p, nameLen, p[0] == 'r' ? "f" : "i", 0, 0);
+    } else if (space == NULL && plan->w.div) {
+        addVariant(plan, p, nameLen, "b", 'w', 0);
+        addVariant(plan, p, nameLen, "w", 'w', 1);
+    } else {
+        addVariant(plan, p, nameLen, "", 0, 0);
+    }
+
+    int swaps = plan->d.div && plan->swapR >= 0 && plan->swapRS >= 0 ? 2 : 1;
+    for (int v = 0; v < plan->numVariants; ++v)
+        for (int swap = 0; swap < swaps; ++swap)
+            insertForms(t, v, swap);
+}
+
+static void compilePlans(void)
+{
+    for (int t = 0; t < NUM_OF_INSTRUCT_TYPES; ++t)
+        compilePlan(t);
+}
+
+/* --- ENCODING --- */
+
+// set a field in the opcode, 1 if the value does not fit
+static inline int putField(uint16_t *opcode, FieldMask m, int value)
+{
+    if (!m.div)
+        return 0;
+    unsigned int bits = (unsigned int)value * m.div;
+    if (value < 0 || (bits & ~(unsigned int)m.mask) != 0)
+        return 1;
+    *opcode |= bits;
+    return 0;
+}
+
+static inline int fitsSext(unsigned int value)
+{
+    value &= 0xffff;
+    return value <= 0x7f || value >= 0xff80;
+}
+
+static inline void putWord(unsigned char *dst, unsigned int value)
+{
+    dst[0] = value & 0xff;
+    dst[1] = (value >> 8) & 0xff;
+}
+
+static inline int setSize(int *w, int wide)
+{
+    if (*w >= 0 && *w != wide)
+        return 1;
+    *w = wide;
+    return 0;
+}
+
+static int writeModRM(unsigned char *dst, const Operand *op, int regBits)
+{
+    if (op->kind == OPERAND_REG) {
+        dst[0] = 0xc0 | regBits << 3 | op->reg;
+        return 1;
+    }
+    if (op->reg == EA_DIRECT) {
+        dst[0] = 0x06 | regBits << 3;
+        putWord(dst + 1, op->value);
+        return 3;
+    }
+    int disp = (int16_t)op->value;
+    if (disp == 0 && op->reg != 6) {
+        dst[0] = regBits << 3 | op->reg;
+        return 1;
+    }
+    if (disp >= -128 && disp <= 127) {
+        dst[0] = 0x40 | regBits << 3 | op->reg;
+        dst[1] = disp & 0xff;
+        return 2;
+    }
+    dst[0] = 0x80 | regBits << 3 | op->reg;
+    putWord(dst + 1, op->value);
+    return 3;
+}
+
+static int encodeForm(const AsmForm *form, const AsmInstruction *asmInstr, unsigned int pos, unsigned char *dst)
+{
+    const EncodePlan *plan = plans + form->type;
+    const AsmVariant *variant = plan->variants + form->variant;
+    const Operand *bySlot[MAX_OPERANDS] = {NULL};
+    int order[MAX_OPERANDS] = {0, 1, 2};
+    if (form->swap) {
+        order[(int)plan->swapR] = plan->swapRS;
+        order[(int)plan->swapRS] = plan->swapR;
+    }
+    for (int i = 0; i < asmInstr->numOps; ++i)
+        bySlot[order[i]] = asmInstr->ops + i;
+
+    int hasW = plan->w.div || plan->W.div;
+    int w = variant->field == 'w' ? variant->value : -1;
+    int r = 0, s = 0, c = 0;
+    const Operand *rm = NULL, *imm = NULL;
+    for (int j = 0; j < plan->numSlots; ++j) {
+        const AsmSlot *slot = plan->slots + j;
+        const Operand *op = bySlot[j];
+        switch (slot->field) {
+        case 'R':
+            rm = op;
+            if (op->kind == OPERAND_REG && (hasW ? setSize(&w, op->wide) : op->wide != 1))
+                return 0;
+            if (op->kind == OPERAND_MEM && hasW && op->wide != ASM_ANY_SIZE && setSize(&w, op->wide))
+                return 0;
+            break;
+        case 'r':
+            r = op->reg;
+            if (hasW ? setSize(&w, op->wide) : op->wide != 1)
+                return 0;
+            break;
+        case 's':
+            s = op->reg;
+            break;
+        case 'w':
+            if (op->reg != 0 || setSize(&w, op->wide))
+                return 0;
+            break;
+        case 'a':
+            if (op->reg != EA_DIRECT || (op->wide != ASM_ANY_SIZE && setSize(&w, op->wide)))
+                return 0;
+            break;
+        case 'D':
+            imm = op;
+            break;
+        case 'p':
+        case 'i':
+            if (op->value > 0xff)
+                return 0;
+            break;
+        case 'c':
+            if (op->kind == OPERAND_REG && op->reg == 1 && op->wide == 0)
+                c = 1;
+            else if (op->kind != OPERAND_TARGET || op->value != 1)
+                return 0;
+            break;
+        case 0:
+            if (slot->reg >= 0 ? op->reg != slot->reg || op->wide != 1 : op->value != slot->value)
+                return 0;
+            break;
+        }
+    }
+    if (hasW && w < 0)
+        return 0;
+    if (!hasW)
+        w = 0;
+
+    // a word immediate fitting a byte is sign extended
+    int W = 0;
+    if (plan->W.div && w)
+        W = imm && fitsSext(imm->value) ? 0b11 : 0b01;
+    int wField = plan->w.div ? w : 0;
+
+    uint16_t opcode = plan->opcodeBits;
+    if (putField(&opcode, plan->w, wField) || putField(&opcode, plan->W, W) ||
+        putField(&opcode, plan->d, form->swap) || putField(&opcode, plan->r, r) ||
+        putField(&opcode, plan->s, s) || putField(&opcode, plan->c, c) ||
+        putField(&opcode, plan->z, variant->field == 'z' ? variant->value : 0) ||
+        putField(&opcode, plan->x, asmInstr->escape >> 3))
+        return 0;
+
+    int len = 0, targetAt = -1, targetLen = 0;
+    unsigned int target = 0;
+    if (plan->opcodeLen > 1)
+        dst[len++] = opcode >> 8;
+    dst[len++] = opcode & 0xff;
+
+    int wordPart = (wField | W) == 1;
+    for (int j = 0; plan->parts[j]; ++j) {
+        const char *part = plan->parts[j];
+        if (part[0] != '(')
+            continue;
+        // the operand of this part
+        const Operand *op = NULL;
+        for (int k = 0; k < plan->numSlots; ++k)
+            if (plan->slots[k].field == part[1])
+                op = bySlot[k];
+
+        switch (part[1]) {
+        case 'R': {
+            int regBits;
+            if (part[2] == 'r')
+                regBits = r;
+            else if (part[2] == 's')
+                regBits = s;
+            else if (part[2] == 'x')
+                regBits = asmInstr->escape & 0x7;
+            else
+                regBits = strtoul(part + 2, NULL, 2);
+            len += writeModRM(dst + len, rm, regBits);
+            break;
+        }
+        case 'D':
+            if (part[2] == 'w' || wordPart) {
+                if (op->value > 0xffff)
+                    return 0;
+                putWord(dst + len, op->value);
+                len += 2;
+            } else {
+                if (W == 0b11 ? !fitsSext(op->value) : op->value > 0xff && (op->value < 0xff80 || op->value > 0xffff))
+                    return 0;
+                dst[len++] = op->value & 0xff;
+            }
+            break;
+        case 'a':
+            if (wordPart) {
+                putWord(dst + len, op->value);
+                len += 2;
+            } else {
+                if (op->value > 0xff)
+                    return 0;
+                dst[len++] = op->value;
+            }
+            break;
+        case 'P':
+            target = op->value;
+            targetAt = len;
+            targetLen = part[2] == 'w' ? 2 : 1;
+            len += targetLen;
+            break;
+        case 'p':
+        case 'i':
+            dst[len++] = op->value;
+            break;
+        case 'o':
+            putWord(dst + len, op->value & 0xffff);
+            putWord(dst + len + 2, op->value >> 16);
+            len += 4;
+            break;
+        }
+    }
+
+    if (targetAt >= 0) {
+        unsigned int disp = (target - pos - len) & 0xffff;
+        if (targetLen == 1) {
+            if (!fitsSext(disp))
+                return 0;
+            dst[targetAt] = disp & 0xff;
+        } else {
+            putWord(dst + targetAt, disp);
+        }
+    }
+    return len;
+}
+
+static char formLetter(const Operand *op)
+{
+    switch (op->kind) {
+    case OPERAND_REG:
+        return 'R';
+    case OPERAND_SEG:
+        return 'S';
+    case OPERAND_MEM:
+        return 'M';
+    case OPERAND_IMM:
+        return 'I';
+    case OPERAND_FAR:
+        return 'F';
+    default:
+        return 'T';
+    }
+}
+
+int encodeInstruction(const AsmInstruction *asmInstr, unsigned int pos, char *dst)
+{
+    return encodeInstructionFit(asmInstr, pos, 0, dst);
+}
+
+int encodeInstructionFit(const AsmInstruction *asmInstr, unsigned int pos, int fit, char *dst)
+{
+    pthread_once(&plansOnce, compilePlans);
+    char forms[MAX_OPERANDS], key[ASM_KEY_LEN];
+    for (int i = 0; i < asmInstr->numOps; ++i)
+        forms[i] = formLetter(asmInstr->ops + i);
+    if (makeKey(key, asmInstr->mnemonic, forms, asmInstr->numOps) != 0)
+        return 0;
+    const AsmBucket *bucket = findBucket(key, 0);
+    if (bucket == NULL)
+        return 0;
+
+    unsigned char best[MAX_INSTRUCT_LEN], bytes[MAX_INSTRUCT_LEN];
+    int bestLen = 0;
+    for (int i = 0; i < bucket->count; ++i) {
+        int len = encodeForm(bucket->forms + i, asmInstr, pos, bytes);
+        if (len > 0 && (bestLen == 0 || (bestLen != fit && (len == fit || len < bestLen)))) {
+            memcpy(best, bytes, len);
+            bestLen = len;
+        }
+    }
+    memcpy(dst, best, bestLen);
+    return bestLen;
+}
+
+/* --- STRUCTURED FORM --- */
+
+int normalizeInstruction(unsigned int pos, Instruction *instr, AsmInstruction *asmInstr)
+{
+    pthread_once(&plansOnce, compilePlans);
+    const EncodePlan *plan = plans + (instr->type - instructionTypes);
+    const unsigned char *data = (const unsigned char *)instr->data;
+    memset(asmInstr, 0, sizeof(AsmInstruction));
+
+    const AsmVariant *variant = plan->variants;
+    for (int v = 1; v < plan->numVariants; ++v) {
+        FieldMask m = plan->variants[v].field == 'w' ? plan->w : plan->z;
+        if (fieldValue(m, data, plan->opcodeLen) == plan->variants[v].value)
+            variant = plan->variants + v;
+    }
+    strcpy(asmInstr->mnemonic, variant->name);
+    if (plan->x.div)
+        asmInstr->escape = fieldValue(plan->x, data, plan->opcodeLen) << 3 | (data[plan->opcodeLen] >> 3 & 0x7);
+
+    asmInstr->numOps = decodeOperands(pos, instr, asmInstr->ops);
+    for (int i = 0; i < asmInstr->numOps; ++i) {
+        Operand *op = asmInstr->ops + i;
+        op->wide &= 1;
+        switch (op->kind) {
+        case OPERAND_ACC:
+            op->kind = OPERAND_REG;
+            op->reg = 0;
+            break;
+        case OPERAND_SEG:
+            op->reg &= 0x3;
+            break;
+        case OPERAND_MEM: {
+            const ModRM *modRM = modRMTable + (unsigned char)op->bytes[0];
+            const unsigned char *disp = (const unsigned char *)op->bytes + 1;
+            op->reg = modRM->ea;
+            if (modRM->dispLen == 1)
+                op->value = (uint16_t)(signed char)disp[0];
+            else if (modRM->dispLen == 2)
+                op->value = disp[0] | disp[1] << 8;
+            break;
+        }
+        case OPERAND_DIRECT:
+            op->kind = OPERAND_MEM;
+            op->reg = EA_DIRECT;
+            break;
+        case OPERAND_PORT:
+        case OPERAND_INT:
+            op->kind = OPERAND_TARGET;
+            break;
+        case OPERAND_COUNT:
+            // by CL or by 1
+            op->kind = op->value ? OPERAND_REG : OPERAND_TARGET;
+            op->reg = 1;
+            op->wide = 0;
+            op->value = op->value ? 0 : 1;
+            break;
+        case OPERAND_LITERAL: {
+            int reg, wide;
+            if (!findRegister(op->text, &reg, &wide))
+                return 1;
+            op->kind = OPERAND_REG;
+            op->reg = reg;
+            op->wide = wide;
+            break;
+        }
+        }
+        op->bytes = NULL;
+        op->text = NULL;
+        op->len = op->strip = op->sext = 0;
+    }
+    return 0;
+}
+
+int sameInstruction(const AsmInstruction *a, const AsmInstruction *b)
+{
+    if (strcmp(a->mnemonic, b->mnemonic) != 0 || a->numOps != b->numOps || a->escape != b->escape)
+        return 0;
+    for (int i = 0; i < a->numOps; ++i) {
+        const Operand *x = a->ops + i, *y = b->ops + i;
+        if (x->kind != y->kind || x->reg != y->reg || x->wide != y->wide || x->value != y->value)
+            return 0;
+    }
+    return 1;
+}
+
+/* --- TEXT --- */
+
+static char *trim(char *str)
+{
+    while (*str == ' ' || *str == '\t')
+        ++str;
+    size_t len = strlen(str);
+    while (len > 0 && (str[len - 1] == ' ' || str[len - 1] == '\t' || str[len - 1] == '\n' || str[len - 1] == '\r'))
+        str[--len] = '\0';
+    return str;
+}
+
+static int parseNumber(const char *str, unsigned int *value)
+{
+    char *end;
+    long n = strtol(str, &end, 0);
+    if (end == str || *trim(end) != '\0' || n < -0x8000 || n > 0xffff)
+        return 1;
+    *value = n & 0xffff;
+    return 0;
+}
+
+static int parseMemory(char *str, Operand *op)
+{
+    int base = 0, index = 0, disp = 0;
+    char *p = str;
+    while (*p) {
+        int sign = 1;
+        if (*p == '+' || *p == '-')
+            sign = *p++ == '-' ? -1 : 1;
+        while (*p == ' ')
+            ++p;
+        if (strncmp(p, "bx", 2) == 0 || strncmp(p, "bp", 2) == 0) {
+            if (base || sign < 0)
+                return 1;
+            base = p[1] == 'x' ? 1 : 2;
+            p += 2;
+        } else if (strncmp(p, "si", 2) == 0 || strncmp(p, "di", 2) == 0) {
+            if (index || sign < 0)
+                return 1;
+            index = p[0] == 's' ? 1 : 2;
+            p += 2;
+        } else {
+            char *end;
+            long n = strtol(p, &end, 0);
+            if (end == p)
+                return 1;
+            disp += sign * n;
+            p = end;
+        }
+        while (*p == ' ')
+            ++p;
+    }
+    op->kind = OPERAND_MEM;
+    op->reg = eaOf[base][index];
+    op->value = disp & 0xffff;
+    return 0;
+}
+
+static int parseOperand(char *str, Operand *op)
+{
+    str = trim(str);
+    memset(op, 0, sizeof(Operand));
+    op->wide = ASM_ANY_SIZE;
+    if (strncmp(str, "byte ptr", 8) == 0 || strncmp(str, "word ptr", 8) == 0) {
+        op->wide = str[0] == 'w';
+        str = trim(str + 8);
+        if (str[0] != '[')
+            return 1;
+    }
+
+    size_t len = strlen(str);
+    int reg, wide;
+    if (str[0] == '[') {
+        if (str[len - 1] != ']')
+            return 1;
+        str[len - 1] = '\0';
+        return parseMemory(str + 1, op);
+    }
+    if (str[0] == '#') {
+        op->kind = OPERAND_IMM;
+        return parseNumber(str + 1, &op->value);
+    }
+    if (len == 2 && findRegister(str, &reg, &wide)) {
+        op->kind = OPERAND_REG;
+        op->reg = reg;
+        op->wide = wide;
+        return 0;
+    }
+    if (len == 2 && (reg = findSegment(str)) >= 0) {
+        op->kind = OPERAND_SEG;
+        op->reg = reg;
+        return 0;
+    }
+    op->kind = OPERAND_TARGET;
+    return parseNumber(str, &op->value);
+}
+
+int parseAsm(const char *line, AsmInstruction *asmInstr)
+{
+    char buf[ASM_LINE_LEN];
+    memset(asmInstr, 0, sizeof(AsmInstruction));
+    if (strlen(line) >= ASM_LINE_LEN)
+        return 1;
+    strcpy(buf, line);
+
+    char *p = trim(buf);
+    size_t nameLen = strcspn(p, " \t");
+    if (nameLen == 0 || nameLen >= ASM_MNEMONIC_LEN)
+        return 1;
+    memcpy(asmInstr->mnemonic, p, nameLen);
+    p = trim(p + nameLen);
+
+    // jmpi 0x5db9,0xf71d is one operand
+    char *ops[MAX_OPERANDS + 1];
+    int n = 0;
+    for (char *op = *p ? p : NULL; op; ++n) {
+        if (n == MAX_OPERANDS + 1)
+            return 1;
+        ops[n] = op;
+        op = strchr(op, ',');
+        if (op)
+            *op++ = '\0';
+    }
+    Operand parsed[MAX_OPERANDS + 1];
+    for (int i = 0; i < n; ++i)
+        if (parseOperand(ops[i], parsed + i) != 0)
+            return 1;
+
+    if (n == 2 && parsed[0].kind == OPERAND_TARGET && parsed[1].kind == OPERAND_TARGET &&
+        (strcmp(asmInstr->mnemonic, "calli") == 0 || strcmp(asmInstr->mnemonic, "jmpi") == 0)) {
+        parsed[0].kind = OPERAND_FAR;
+        parsed[0].value |= parsed[1].value << 16;
+        n = 1;
+    }
+    // esc 0xb, [0x723f] : the external opcode is not an operand of the template
+    if (n == 2 && parsed[0].kind == OPERAND_TARGET && strcmp(asmInstr->mnemonic, "esc") == 0) {
+        if (parsed[0].value > 0x3f)
+            return 1;
+        asmInstr->escape = parsed[0].value;
+        parsed[0] = parsed[1];
+        n = 1;
+    }
+    if (n > MAX_OPERANDS)
+        return 1;
+    memcpy(asmInstr->ops, parsed, sizeof(Operand) * n);
+    asmInstr->numOps = n;
+    return 0;
+}
+
+/* --- TOOLS --- */
+
+int roundtripImage(FILE *file, Image *img)
+{
+    OutBuffer out;
+    if (initOutBuffer(&out, file, OUT_BUFFER_SIZE) != 0)
+        return 1;
+
+    pthread_once(&plansOnce, compilePlans);
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    unsigned int count = 0, identical = 0, equivalent = 0, failed = 0, undefined = 0;
+    unsigned int pos = 0;
+    while (pos < (unsigned int)img->textLen) {
+        Instruction res = readInstruction(img->text, img->textLen, pos);
+        if (res.length == 0) {
+            // the rest of the text is not checked
+            ++failed;
+            outFlush(&out);
+            fprintf(file, "%04x: zero length instruction\n", pos);
+            break;
+        }
+        ++count;
+        if (res.type == NULL) {
+            ++undefined;
+            pos += res.length;
+            continue;
+        }
+
+        AsmInstruction asmInstr, again;
+        char bytes[MAX_INSTRUCT_LEN];
+        int len = normalizeInstruction(pos, &res, &asmInstr) == 0 ? encodeInstruction(&asmInstr, pos, bytes) : 0;
+        if (len == (int)res.length && memcmp(bytes, res.data, len) == 0) {
+            ++identical;
+        } else {
+            Instruction re = len ? readInstruction(bytes, len, 0) : res;
+            if (len && re.type && re.length == (unsigned int)len) {
+                if (normalizeInstruction(pos, &re, &again) == 0 && sameInstruction(&asmInstr, &again)) {
+                    ++equivalent;
+                    pos += res.length;
+                    continue;
+                }
+            }
+            if (failed++ < ROUNDTRIP_MAX_REPORTS) {
+                formatInstruction(&out, pos, &res);
+                outStr(&out, "      -> ");
+                if (len)
+                    outHex(&out, bytes, len);
+                else
+                    outStr(&out, "no encoding");
+                outChar(&out, '\n');
+            }
+        }
+        pos += res.length;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    outFlush(&out);
+    freeOutBuffer(&out);
+    fprintf(file, "%u instructions: %u identical, %u equivalent, %u failed, %u undefined (%.1f M/s)\n",
+            count, identical, equivalent, failed, undefined, seconds > 0 ? count / seconds / 1e6 : 0.0);
+    return failed != 0;
+}
+
+int assembleStream(FILE *in, OutBuffer *out, unsigned int pos)
+{
+    char line[ASM_LINE_LEN];
+    for (int n = 1; fgets(line, sizeof(line), in); ++n) {
+        char *text = trim(line);
+        if (*text == '\0' || *text == ';')
+            continue;
+
+        AsmInstruction asmInstr;
+        char bytes[MAX_INSTRUCT_LEN];
+        int len = parseAsm(text, &asmInstr) == 0 ? encodeInstruction(&asmInstr, pos, bytes) : 0;
+        if (len == 0) {
+            outFlush(out);
+            printf("line %d: cannot assemble %s\n", n, text);
+            return 1;
+        }
+        Instruction res = readInstruction(bytes, len, 0);
+        formatInstruction(out, pos, &res);
+        outMaybeFlush(out);
+        pos += len;
+    }
+    return 0;
+}
+
+int patchImage(const char *path, unsigned int addr, const char *line, int force)
+{
+    AsmInstruction asmInstr;
+    if (parseAsm(line, &asmInstr) != 0) {
+        printf("cannot assemble %s\n", line);
+        return 1;
+    }
+
+    Image img;
+    if (openImage(path, &img) != 0)
+        return 1;
+    long offset = img.text - img.map;
+    int textLen = img.textLen;
+
+    // the instruction replaced, found by a sweep from 0
+    unsigned int pos = 0;
+    int oldLen = 0;
+    while (pos < addr) {
+        Instruction res = readInstruction(img.text, img.textLen, pos);
+        if (res.length == 0)
+            break;
+        pos += res.length;
+    }
+    if (pos == addr && addr < (unsigned int)textLen)
+        oldLen = readInstruction(img.text, img.textLen, addr).length;
+    if (oldLen == 0) {
+        closeImage(&img);
+        printf("%04x is not an instruction boundary\n", addr);
+        return 1;
+    }
+
+    // room for the padding up to the end of the last instruction cut
+    char bytes[2 * MAX_INSTRUCT_LEN];
+    int len = encodeInstructionFit(&asmInstr, addr, oldLen, bytes);
+    int status = 0;
+    if (len == 0) {
+        printf("cannot assemble %s\n", line);
+        status = 1;
+    } else if (len > oldLen && !force) {
+        printf("%s takes %d bytes, the instruction at %04x %d, --force overwrites the next ones\n", line, len,
+               addr, oldLen);
+        status = 1;
+    } else if (addr + len > (unsigned int)textLen) {
+        printf("%04x is out of the text\n", addr);
+        status = 1;
+    }
+
+    // the old instructions covered, the last one cut is padded to its end
+    unsigned int end = addr;
+    OutBuffer out;
+    if (status == 0 && (status = initOutBuffer(&out, stdout, OUT_BUFFER_SIZE)) == 0) {
+        while (end < addr + len) {
+            Instruction res = readInstruction(img.text, img.textLen, end);
+            if (res.length == 0) {
+                end = addr + len;
+                break;
+            }
+            if (len > oldLen) {
+                outStr(&out, "overwritten ");
+                formatInstruction(&out, end, &res);
+            }
+            end += res.length;
+        }
+        freeOutBuffer(&out);
+    }
+    closeImage(&img);
+    if (status != 0)
+        return 1;
+    // a shorter form keeps the next instructions where they are
+    while ((unsigned int)len < end - addr)
+        bytes[len++] = (char)0x90;
+
+    FILE *file = fopen(path, "r+b");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+    status = fseek(file, offset + addr, SEEK_SET) != 0 || fwrite(bytes, 1, len, file) != (size_t)len;
+    if (status | fclose(file)) {
+        printf("cannot write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
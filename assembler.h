@@ -0,0 +1,149 @@
+#ifndef ASSEMBLER_H
+#define ASSEMBLER_H
+
+#include "image.h"
+#include "instruction.h"
+#include "output.h"
+#include "syntax.h"
+#include <stdio.h>
+
+/*
+ * --- ASSEMBLER ---
+ *
+ * The codeFormat templates read the other way : the opcode bits are given,
+ * the fields (w W d r s c z x) are set from the operands and the parts are
+ * written from them, (R) as a ModRM byte and its displacement, (D) as the
+ * data... Part lengths follow the same rules as calcInstrLength, so what
+ * is encoded is decoded back to the same type.
+ *
+ * An instruction is a mnemonic and operands, in the spelling of the as86
+ * syntax (calli, retf, movsb, rep / repnz). It is given structured, as
+ * normalizeInstruction makes it from a decoded one, or as a line of text
+ * as --syntax as86 prints it :
+ *   mov word ptr [bx+si+0x2], #0x10
+ *   jmpi 0x5db9,0xf71d
+ *
+ * The types an instruction can be encoded with are found in a hash table
+ * keyed by the mnemonic and the operand form, a letter per operand : R
+ * register, S segment, M memory, I immediate, T number (target, port,
+ * interrupt, shift by 1), F far pointer. Each of them is tried and the
+ * shortest encoding kept, the first in table order on a tie.
+ *
+ * --- ROUND TRIP ---
+ *
+ * dis --roundtrip FILE decodes each instruction of the text, encodes it
+ * again and compares :
+ *   identical  : the same bytes
+ *   equivalent : other bytes decoding to the same instruction, a shorter
+ *                displacement or immediate, the other direction bit...
+ *   failed     : no encoding, or one decoding to something else
+ */
+
+#define ASM_MNEMONIC_LEN 8
+#define ASM_ANY_SIZE 2 // memory operand of no given size
+
+/**
+ * @brief An instruction to encode. Operands are OPERAND_REG, SEG, MEM,
+ * IMM, TARGET (any number) or FAR; a memory operand has its r/m or
+ * EA_DIRECT in reg and its displacement or address in value.
+ * @param mnemonic char[ASM_MNEMONIC_LEN]
+ * @param numOps int
+ * @param escape unsigned char external opcode of esc, 6 bits
+ * @param ops Operand[MAX_OPERANDS]
+ */
+typedef struct AsmInstructionStruct {
+    char mnemonic[ASM_MNEMONIC_LEN];
+    int numOps;
+    unsigned char escape;
+    Operand ops[MAX_OPERANDS];
+} AsmInstruction;
+
+/**
+ * @brief Make the structured form of a decoded instruction
+ *
+ * @param pos unsigned int
+ * @param instr Instruction* of a known type
+ * @param asmInstr AsmInstruction*
+ * @return int 0 on success, 1 if a template literal is not a register
+ */
+int normalizeInstruction(unsigned int pos, Instruction *instr, AsmInstruction *asmInstr);
+
+/**
+ * @brief Parse a line of as86 text
+ *
+ * @param line const char*
+ * @param asmInstr AsmInstruction*
+ * @return int 0 on success, 1 if it can not be parsed
+ */
+int parseAsm(const char *line, AsmInstruction *asmInstr);
+
+/**
+ * @brief Encode an instruction at a position (relative targets)
+ *
+ * @param asmInstr const AsmInstruction*
+ * @param pos unsigned int
+ * @param dst char* MAX_INSTRUCT_LEN bytes
+ * @return int the length, 0 if it has no encoding
+ */
+int encodeInstruction(const AsmInstruction *asmInstr, unsigned int pos, char *dst);
+
+/**
+ * @brief Encode an instruction in a given length if one of its forms
+ * takes it, in the shortest otherwise
+ *
+ * @param asmInstr const AsmInstruction*
+ * @param pos unsigned int
+ * @param fit int the length wanted
+ * @param dst char* MAX_INSTRUCT_LEN bytes
+ * @return int the length, 0 if it has no encoding
+ */
+int encodeInstructionFit(const AsmInstruction *asmInstr, unsigned int pos, int fit, char *dst);
+
+/**
+ * @brief Compare two structured instructions
+ *
+ * @param a const AsmInstruction*
+ * @param b const AsmInstruction*
+ * @return int 1 if they are the same instruction
+ */
+int sameInstruction(const AsmInstruction *a, const AsmInstruction *b);
+
+/**
+ * @brief Decode, encode and compare every instruction of a text, print
+ * the failures and a summary. A zero length instruction stops it and
+ * counts as a failure
+ *
+ * @param out FILE*
+ * @param img Image*
+ * @return int 0 if none failed, 1 otherwise
+ */
+int roundtripImage(FILE *out, Image *img);
+
+/**
+ * @brief dis asm [ADDR] : assemble as86 lines, list them as they decode
+ *
+ * @param in FILE*
+ * @param out OutBuffer*
+ * @param pos unsigned int of the first line
+ * @return int 0 on success, 1 on the first line that does not assemble
+ */
+int assembleStream(FILE *in, OutBuffer *out, unsigned int pos);
+
+/**
+ * @brief dis patch [--force] FILE ADDR TEXT : assemble an instruction over
+ * the instruction at ADDR of an executable, in place
+ *
+ * A form as long as the old instruction is preferred, a shorter one is
+ * padded with nop (0x90). A longer one overwrites the next instructions,
+ * only if forced : they are listed, and the last one cut is padded with
+ * nop to its end.
+ *
+ * @param path const char*
+ * @param addr unsigned int an instruction boundary
+ * @param line const char*
+ * @param force int
+ * @return int 0 on success, 1 on error
+ */
+int patchImage(const char *path, unsigned int addr, const char *line, int force);
+
+#endif
@@ -0,0 +1,317 @@
+#include "cycles.h"
+#include "disasembler.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define F CYCLES_FALL
+#define B CYCLES_BRANCH
+#define J CYCLES_JUMP
+#define C CYCLES_CALL
+#define N CYCLES_COUNT
+
+const CycleCost cycleCosts[NUM_OF_INSTRUCT_TYPES] = {
+    // reg, mem, load, word, transfers, taken, flow
+    {2, 9, 8, 0, 1, 0, F},      // mov $R, $r
+    {4, 10, 0, 0, 1, 0, F},     // mov $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // mov $r, $D
+    {10, 0, 0, 0, 1, 0, F},     // mov a$w, $a
+    {10, 0, 0, 0, 1, 0, F},     // mov $a, a$w
+    {2, 9, 8, 0, 1, 0, F},      // mov $R, $s
+    {11, 16, 0, 0, 2, 0, F},    // push $R
+    {11, 0, 0, 0, 0, 0, F},     // push $r
+    {10, 0, 0, 0, 0, 0, F},     // push $s
+    {8, 17, 0, 0, 2, 0, F},     // pop $R
+    {8, 0, 0, 0, 0, 0, F},      // pop $r
+    {8, 0, 0, 0, 0, 0, F},      // pop $s
+    {4, 17, 0, 0, 2, 0, F},     // xchg $R, $r
+    {3, 0, 0, 0, 0, 0, F},      // xchg ax, $r
+    {10, 0, 0, 0, 0, 0, F},     // in a$w, $p
+    {8, 0, 0, 0, 0, 0, F},      // in a$w, dx
+    {10, 0, 0, 0, 0, 0, F},     // out $p, a$w
+    {8, 0, 0, 0, 0, 0, F},      // out dx, a$w
+    {11, 0, 0, 0, 0, 0, F},     // xlat
+    {2, 2, 0, 0, 0, 0, F},      // lea $r, $R
+    {16, 16, 0, 0, 2, 0, F},    // lds $r, $R
+    {16, 16, 0, 0, 2, 0, F},    // les $r, $R
+    {4, 0, 0, 0, 0, 0, F},      // lahf
+    {4, 0, 0, 0, 0, 0, F},      // sahf
+    {10, 0, 0, 0, 0, 0, F},     // pushf
+    {8, 0, 0, 0, 0, 0, F},      // popf
+    {3, 16, 9, 0, 2, 0, F},     // add $R, $r
+    {4, 17, 0, 0, 2, 0, F},     // add $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // add a$w, $D
+    {3, 16, 9, 0, 2, 0, F},     // adc $R, $r
+    {4, 17, 0, 0, 2, 0, F},     // adc $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // adc a$w, $D
+    {3, 15, 0, 0, 2, 0, F},     // inc $R
+    {2, 0, 0, 0, 0, 0, F},      // inc $r
+    {4, 0, 0, 0, 0, 0, F},      // aaa
+    {4, 0, 0, 0, 0, 0, F},      // baa
+    {3, 16, 9, 0, 2, 0, F},     // sub $R, $r
+    {4, 17, 0, 0, 2, 0, F},     // sub $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // sub a$w, $D
+    {3, 16, 9, 0, 2, 0, F},     // sbb $R, $r
+    {4, 17, 0, 0, 2, 0, F},     // sbb $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // sbb a$w, $D
+    {3, 15, 0, 0, 2, 0, F},     // dec $R
+    {2, 0, 0, 0, 0, 0, F},      // dec $r
+    {3, 16, 0, 0, 2, 0, F},     // neg $R
+    {3, 9, 9, 0, 1, 0, F},      // cmp $R, $r
+    {4, 10, 0, 0, 1, 0, F},     // cmp $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // cmp a$w, $D
+    {4, 0, 0, 0, 0, 0, F},      // aas
+    {4, 0, 0, 0, 0, 0, F},      // das
+    {77, 83, 0, 56, 1, 0, F},   // mul $R
+    {98, 104, 0, 56, 1, 0, F},  // imul $R
+    {83, 0, 0, 0, 0, 0, F},     // aam
+    {90, 96, 0, 72, 1, 0, F},   // div $R
+    {112, 118, 0, 72, 1, 0, F}, // idiv $R
+    {60, 0, 0, 0, 0, 0, F},     // aad
+    {2, 0, 0, 0, 0, 0, F},      // cbw
+    {5, 0, 0, 0, 0, 0, F},      // cwd
+    {3, 16, 0, 0, 2, 0, F},     // not $R
+    {2, 15, 0, 0, 2, 0, N},     // shl $R, $c
+    {2, 15, 0, 0, 2, 0, N},     // shr $R, $c
+    {2, 15, 0, 0, 2, 0, N},     // sar $R, $c
+    {2, 15, 0, 0, 2, 0, N},     // rol $R, $c
+    {2, 15, 0, 0, 2, 0, N},     // ror $R, $c
+    {2, 15, 0, 0, 2, 0, N},     // rcl $R, $c
+    {2, 15, 0, 0, 2, 0, N},     // rcr $R, $c
+    {3, 16, 9, 0, 2, 0, F},     // and $R, $r
+    {4, 17, 0, 0, 2, 0, F},     // and $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // and a$w, $D
+    {3, 9, 9, 0, 1, 0, F},      // test $R, $r
+    {5, 11, 0, 0, 1, 0, F},     // test $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // test a$w, $D
+    {3, 16, 9, 0, 2, 0, F},     // or $R, $r
+    {4, 17, 0, 0, 2, 0, F},     // or $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // or a$w, $D
+    {3, 16, 9, 0, 2, 0, F},     // xor $R, $r
+    {4, 17, 0, 0, 2, 0, F},     // xor $R, $D
+    {4, 0, 0, 0, 0, 0, F},      // xor a$w, $D
+    {2, 0, 0, 0, 0, 0, F},      // rep
+    {18, 0, 0, 0, 0, 0, F},     // movs
+    {22, 0, 0, 0, 0, 0, F},     // cmps
+    {15, 0, 0, 0, 0, 0, F},     // scas
+    {12, 0, 0, 0, 0, 0, F},     // lods
+    {11, 0, 0, 0, 0, 0, F},     // stos
+    {19, 0, 0, 0, 0, 0, C},     // call $P
+    {16, 21, 0, 0, 2, 0, C},    // call $R
+    {28, 0, 0, 0, 0, 0, C},     // call $o
+    {37, 37, 0, 0, 4, 0, C},    // call $R (intersegment)
+    {15, 0, 0, 0, 0, 0, J},     // jmp $P
+    {15, 0, 0, 0, 0, 0, J},     // jmp short $P
+    {11, 18, 0, 0, 1, 0, J},    // jmp $R
+    {15, 0, 0, 0, 0, 0, J},     // jmp $o
+    {24, 24, 0, 0, 2, 0, J},    // jmp $R (intersegment)
+    {8, 0, 0, 0, 0, 0, J},      // ret
+    {12, 0, 0, 0, 0, 0, J},     // ret $D
+    {18, 0, 0, 0, 0, 0, J},     // ret (intersegment)
+    {17, 0, 0, 0, 0, 0, J},     // ret $D (intersegment)
+    {4, 0, 0, 0, 0, 16, B},     // je $P
+    {4, 0, 0, 0, 0, 16, B},     // jl $P
+    {4, 0, 0, 0, 0, 16, B},     // jle $P
+    {4, 0, 0, 0, 0, 16, B},     // jb $P
+    {4, 0, 0, 0, 0, 16, B},     // jbe $P
+    {4, 0, 0, 0, 0, 16, B},     // jp $P
+    {4, 0, 0, 0, 0, 16, B},     // jo $P
+    {4, 0, 0, 0, 0, 16, B},     // js $P
+    {4, 0, 0, 0, 0, 16, B},     // jne $P
+    {4, 0, 0, 0, 0, 16, B},     // jnl $P
+    {4, 0, 0, 0, 0, 16, B},     // jg $P
+    {4, 0, 0, 0, 0, 16, B},     // jnb $P
+    {4, 0, 0, 0, 0, 16, B},     // ja $P
+    {4, 0, 0, 0, 0, 16, B},     // jnp $P
+    {4, 0, 0, 0, 0, 16, B},     // jno $P
+    {4, 0, 0, 0, 0, 16, B},     // jns $P
+    {6, 0, 0, 0, 0, 18, B},     // jcxz $P
+    {5, 0, 0, 0, 0, 17, B},     // loop $P
+    {6, 0, 0, 0, 0, 18, B},     // loopz $P
+    {5, 0, 0, 0, 0, 19, B},     // loopnz $P
+    {51, 0, 0, 0, 0, 0, C},     // int $i
+    {52, 0, 0, 0, 0, 0, C},     // int 03
+    {4, 0, 0, 0, 0, 53, B},     // into
+    {24, 0, 0, 0, 0, 0, J},     // iret
+    {2, 0, 0, 0, 0, 0, F},      // clc
+    {2, 0, 0, 0, 0, 0, F},      // cmc
+    {2, 0, 0, 0, 0, 0, F},      // stc
+    {2, 0, 0, 0, 0, 0, F},      // cld
+    {2, 0, 0, 0, 0, 0, F},      // std
+    {2, 0, 0, 0, 0, 0, F},      // cli
+    {2, 0, 0, 0, 0, 0, F},      // sti
+    {2, 0, 0, 0, 0, 0, J},      // hlt
+    {3, 0, 0, 0, 0, 0, F},      // wait
+    {2, 8, 0, 0, 1, 0, F},      // esc $R
+    {2, 0, 0, 0, 0, 0, F},      // lock
+};
+
+#undef F
+#undef B
+#undef J
+#undef C
+#undef N
+
+const uint8_t eaCycles[NUM_OF_EA] = {7, 8, 8, 7, 5, 5, 5, 5, 6, 0};
+
+// types with an address given alone ($a), for the odd word penalty
+static uint8_t directAddress[NUM_OF_INSTRUCT_TYPES];
+static pthread_once_t directOnce = PTHREAD_ONCE_INIT;
+
+static void initDirectAddress(void)
+{
+    for (int t = 0; t < NUM_OF_INSTRUCT_TYPES; ++t)
+        directAddress[t] = strstr(instructionTypes[t].codeFormat, "(a)") != NULL;
+}
+
+int instructionCycles(const Record *rec, const char *text, int *taken)
+{
+    *taken = 0;
+    if (rec->typeId == RECORD_UNDEFINED)
+        return 0;
+    pthread_once(&directOnce, initDirectAddress);
+
+    const CycleCost *cost = cycleCosts + rec->typeId;
+    const unsigned char *bytes = (const unsigned char *)text + rec->offset;
+    uint16_t op = rec->operands;
+    int w = OPERANDS_W(op);
+    int cycles = cost->reg;
+    int address = -1; // known memory address, for the odd word penalty
+
+    if (OPERANDS_HAS_MODRM(op) && OPERANDS_MOD(op) != 0b11) {
+        const ModRM *modRM = modRMTable + bytes[1];
+        cycles = (OPERANDS_D(op) && cost->load) ? cost->load : cost->mem;
+        cycles += eaCycles[modRM->ea] + (modRM->dispLen && modRM->ea != EA_DIRECT ? 4 : 0);
+        if (modRM->ea == EA_DIRECT)
+            address = bytes[2] | bytes[3] << 8;
+        if (cost->flow == CYCLES_COUNT && (bytes[0] & 0x2))
+            cycles += CYCLES_CL_MEM;
+    } else if (cost->flow == CYCLES_COUNT && (bytes[0] & 0x2)) {
+        cycles += CYCLES_CL_REG;
+    } else if (directAddress[rec->typeId]) {
+        address = bytes[1] | bytes[2] << 8;
+    }
+
+    if (w) {
+        cycles += cost->word;
+        if (address >= 0 && (address & 1))
+            cycles += CYCLES_ODD_TRANSFER * cost->transfers;
+    }
+    if (cost->flow == CYCLES_BRANCH)
+        *taken = cost->taken;
+    return cycles;
+}
+
+static void cyclesLine(OutBuffer *out, DecodedText *dec, char *text, unsigned int i, int cycles, int taken)
+{
+    static const char fill[CYCLES_COLUMN + 3] = "                                                ; ";
+    Instruction instr = recordInstruction(dec, text, i);
+    size_t start = out->len;
+    formatInstruction(out, dec->offsets[i], &instr);
+    --out->len; // the line goes on after the instruction
+
+    int pad = CYCLES_COLUMN - (int)(out->len - start);
+    if (pad < 1)
+        pad = 1;
+    outWrite(out, fill + CYCLES_COLUMN - pad, pad + 2);
+    outDecimal(out, cycles);
+    if (taken) {
+        outChar(out, '/');
+        outDecimal(out, taken);
+    }
+    outChar(out, '\n');
+}
+
+static void cyclesTotal(OutBuffer *out, const char *what, unsigned int from, unsigned int to, long cycles)
+{
+    outWrite(out, "      ; ", 8);
+    outStr(out, what);
+    outChar(out, ' ');
+    outAddr(out, from);
+    outChar(out, '-');
+    outAddr(out, to);
+    outWrite(out, ": ", 2);
+    outDecimal(out, cycles);
+    outChar(out, '\n');
+}
+
+int listCycles(OutBuffer *out, Image *img, ListingStats *stats)
+{
+    DecodedText dec;
+    if (initDecodedText(&dec, img->textLen / 3) != 0)
+        return 1;
+    int status = decodeText(img->text, img->textLen, &dec);
+
+    unsigned int count = dec.count;
+    uint16_t *cycles = malloc(sizeof(uint16_t) * (count + 1));
+    uint16_t *taken = malloc(sizeof(uint16_t) * (count + 1));
+    long *before = malloc(sizeof(long) * (count + 1)); // sum of the counts before each record
+    char *leaders = calloc(count + 1, 1);
+    unsigned int *loops = malloc(sizeof(unsigned int) * (count + 1)); // 1 + record a branch goes back to, or 0
+    if (cycles == NULL || taken == NULL || before == NULL || leaders == NULL || loops == NULL) {
+        free(cycles);
+        free(taken);
+        free(before);
+        free(leaders);
+        free(loops);
+        freeDecodedText(&dec);
+        return 1;
+    }
+
+    // counts, the first instruction of each basic block, and the loops
+    before[0] = 0;
+    leaders[0] = 1;
+    for (unsigned int i = 0; i < count; ++i) {
+        Record rec = getRecord(&dec, i);
+        countListed(stats, rec.typeId == RECORD_UNDEFINED);
+        int t;
+        cycles[i] = instructionCycles(&rec, img->text, &t);
+        taken[i] = t;
+        before[i + 1] = before[i] + cycles[i];
+
+        loops[i] = 0;
+        unsigned int target;
+        if (recordTarget(&rec, img->text, &target) > 0 && target < (unsigned int)img->textLen) {
+            unsigned int j = findRecord(&dec, target);
+            if (dec.offsets[j] == target) {
+                leaders[j] = 1;
+                if (target <= rec.offset)
+                    loops[i] = j + 1;
+            }
+        }
+        if (rec.typeId != RECORD_UNDEFINED && cycleCosts[rec.typeId].flow != CYCLES_FALL &&
+            cycleCosts[rec.typeId].flow != CYCLES_COUNT)
+            leaders[i + 1] = 1;
+    }
+
+    unsigned int blockStart = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        cyclesLine(out, &dec, img->text, i, cycles[i], taken[i]);
+
+        if (i + 1 == count || leaders[i + 1]) {
+            cyclesTotal(out, "block", dec.offsets[blockStart], dec.offsets[i], before[i + 1] - before[blockStart]);
+            blockStart = i + 1;
+        }
+
+        // backward branch : one iteration from the target to the branch taken
+        if (loops[i]) {
+            unsigned int j = loops[i] - 1;
+            int back = taken[i] ? taken[i] : cycles[i];
+            cyclesTotal(out, "loop", dec.offsets[j], dec.offsets[i], before[i] - before[j] + back);
+        }
+        outMaybeFlush(out);
+    }
+
+    if (status != 0) {
+        outStr(out, "zero length instruction\n");
+        outFlush(out);
+    }
+
+    free(cycles);
+    free(taken);
+    free(before);
+    free(leaders);
+    free(loops);
+    freeDecodedText(&dec);
+    return status;
+}
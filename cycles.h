@@ -0,0 +1,92 @@
+#ifndef CYCLES_H
+#define CYCLES_H
+
+#include "disasembler.h"
+#include "image.h"
+#include "output.h"
+#include "records.h"
+#include <stdint.h>
+
+/*
+ * --- CYCLES ---
+ *
+ * Documented 8086 clock counts, per instruction type (same order as
+ * instructionTypes) :
+ *   reg       : register operands, no operand, or a branch not taken
+ *   mem       : r/m is memory, without the EA time
+ *   load      : r/m is memory and the source (d = 1), 0 if same as mem
+ *   word      : added when w = 1 (multiply and divide)
+ *   transfers : word memory transfers, 4 clocks each at an odd address
+ *               (only known for direct [disp] operands)
+ *   taken     : conditional branch taken
+ *   flow      : CYCLES_BRANCH, CYCLES_JUMP, CYCLES_CALL, CYCLES_COUNT
+ *
+ * Where the manual gives a range (mul, div) the upper bound is used.
+ * Shifts and rotates by CL and repeated string primitives are counted
+ * for a single bit or iteration.
+ *
+ * EA time : [disp] 6, [bx] [bp] [si] [di] 5, [bp+di] [bx+si] 7,
+ * [bp+si] [bx+di] 8, +4 with a displacement.
+ *
+ * The --cycles listing adds the count of each instruction, "not taken /
+ * taken" for conditional branches, the total of each basic block after
+ * its last instruction, and the total of one iteration after each
+ * backward branch (the loop from its target to the branch, taken).
+ */
+
+#define CYCLES_FALL 0   // falls through to the next instruction
+#define CYCLES_BRANCH 1 // conditional, falls through or jumps
+#define CYCLES_JUMP 2   // never falls through : jmp, ret, iret, hlt
+#define CYCLES_CALL 3   // returns to the next instruction : call, int
+#define CYCLES_COUNT 4  // shift or rotate, by CL if c = 1
+
+#define CYCLES_CL_REG 10     // added for a shift by CL, register : 8 + 4 for one bit
+#define CYCLES_CL_MEM 9      // added for a shift by CL, memory : 20 + EA + 4 for one bit
+#define CYCLES_ODD_TRANSFER 4
+#define CYCLES_COLUMN 48     // column of the counts in the listing
+
+/**
+ * @brief Clock counts of an instruction type
+ * @param reg uint8_t
+ * @param mem uint8_t
+ * @param load uint8_t
+ * @param word uint8_t
+ * @param transfers uint8_t
+ * @param taken uint8_t
+ * @param flow uint8_t
+ */
+typedef struct CycleCostStruct {
+    uint8_t reg;
+    uint8_t mem;
+    uint8_t load;
+    uint8_t word;
+    uint8_t transfers;
+    uint8_t taken;
+    uint8_t flow;
+} CycleCost;
+
+extern const CycleCost cycleCosts[NUM_OF_INSTRUCT_TYPES];
+extern const uint8_t eaCycles[NUM_OF_EA];
+
+/**
+ * @brief Clock count of a decoded instruction
+ *
+ * @param rec const Record*
+ * @param text const char*
+ * @param taken int* set to the count when the branch is taken, 0 if not a
+ * conditional branch
+ * @return int the count, not taken for a conditional branch
+ */
+int instructionCycles(const Record *rec, const char *text, int *taken);
+
+/**
+ * @brief List the text segment with the clock counts
+ *
+ * @param out OutBuffer*
+ * @param img Image*
+ * @param stats ListingStats* counted, or NULL
+ * @return int 0 on success, 1 on error
+ */
+int listCycles(OutBuffer *out, Image *img, ListingStats *stats);
+
+#endif
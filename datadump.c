@@ -0,0 +1,217 @@
+#include "datadump.h"
+#include "hexfmt.h"
+#include "records.h"
+#include "xref.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MARK_REF 1
+#define MARK_SYMBOL 2
+
+static void markRef(Image *img, char *marks, unsigned int addr, char mark)
+{
+    if (addr >= img->dataBase && addr < img->dataBase + img->dataLen)
+        marks[addr - img->dataBase] |= mark;
+}
+
+int collectDataRefs(Image *img, char *marks)
+{
+    DecodedText dec;
+    if (initDecodedText(&dec, img->textLen / 3) != 0)
+        return 1;
+    decodeText(img->text, img->textLen, &dec);
+
+    XrefTable xrefs;
+    int status = collectXrefs(img, &dec, &xrefs);
+    freeDecodedText(&dec);
+    if (status != 0)
+        return 1;
+
+    for (unsigned int i = 0; i < xrefs.count; ++i)
+        if (!XREF_IS_CODE(xrefs.byFrom[i].kind))
+            markRef(img, marks, xrefs.byFrom[i].to, MARK_REF);
+
+    freeXrefs(&xrefs);
+    return 0;
+}
+
+static void dumpLabel(OutBuffer *out, Image *img, unsigned int offset)
+{
+    const Symbol *sym = findSymbolAt(&img->syms, N_DATA, img->dataBase + offset);
+    if (sym) {
+        outStr(out, sym->name);
+    } else {
+        outWrite(out, "d_", 2);
+        outAddr(out, img->dataBase + offset);
+    }
+    outWrite(out, ":\n", 2);
+}
+
+static void dumpHexLine(OutBuffer *out, Image *img, unsigned int offset, int len)
+{
+    const unsigned char *bytes = (unsigned char *)img->data + offset;
+    char hex[2 * DATA_LINE_LEN];
+    hexEncode(hex, bytes, len);
+
+    outAddr(out, img->dataBase + offset);
+    // "xxxx xxxx ... " groups of 2 bytes, then the ascii column
+    char *dst = outReserve(out, 2 + DATA_LINE_LEN / 2 * 5 + 1 + DATA_LINE_LEN + 1);
+    char *p = dst;
+    *p++ = ':';
+    *p++ = ' ';
+    for (int i = 0; i < DATA_LINE_LEN; i += 2) {
+        for (int j = i; j < i + 2; ++j) {
+            if (j < len) {
+                *p++ = hex[2 * j];
+                *p++ = hex[2 * j + 1];
+            } else {
+                *p++ = ' ';
+                *p++ = ' ';
+            }
+        }
+        *p++ = ' ';
+    }
+    *p++ = ' ';
+    for (int i = 0; i < len; ++i)
+        *p++ = (bytes[i] >= 0x20 && bytes[i] < 0x7f) ? bytes[i] : '.';
+    *p++ = '\n';
+    out->len += p - dst;
+}
+
+unsigned int asciiRunLength(const char *bytes, unsigned int len, unsigned int minLen)
+{
+    unsigned int i = 0;
+    while (i < len && isPrintable((unsigned char)bytes[i]))
+        ++i;
+    if (i < minLen || (i < len && bytes[i] != '\0'))
+        return 0;
+    // the terminating zero belongs to the string
+    return i + (i < len);
+}
+
+void dumpAscii(OutBuffer *out, unsigned int addr, const char *bytes, int len)
+{
+    for (int start = 0; start < len; start += DATA_ASCII_PER_LINE) {
+        int n = len - start < DATA_ASCII_PER_LINE ? len - start : DATA_ASCII_PER_LINE;
+        outAddr(out, addr + start);
+        outWrite(out, ": .ascii \"", 10);
+        for (int i = start; i < start + n; ++i) {
+            unsigned char c = bytes[i];
+            switch (c) {
+            case '\n':
+                outWrite(out, "\\n", 2);
+                break;
+            case '\t':
+                outWrite(out, "\\t", 2);
+                break;
+            case '\r':
+                outWrite(out, "\\r", 2);
+                break;
+            case '\0':
+                outWrite(out, "\\0", 2);
+                break;
+            case '"':
+            case '\\':
+                outChar(out, '\\');
+                outChar(out, c);
+                break;
+            default:
+                outChar(out, c);
+                break;
+            }
+        }
+        outWrite(out, "\"\n", 2);
+    }
+}
+
+static void dumpWords(OutBuffer *out, Image *img, unsigned int offset, int len)
+{
+    const unsigned char *bytes = (unsigned char *)img->data + offset;
+    int i = 0;
+    for (; i + 1 < len; i += 2 * DATA_WORDS_PER_LINE) {
+        outAddr(out, img->dataBase + offset + i);
+        outWrite(out, ": .data2 ", 9);
+        for (int j = i; j < i + 2 * DATA_WORDS_PER_LINE && j + 1 < len; j += 2) {
+            if (j != i)
+                outWrite(out, ", ", 2);
+            hexEncodeWord(outReserve(out, 4), bytes[j] | bytes[j + 1] << 8);
+            out->len += 4;
+        }
+        outChar(out, '\n');
+    }
+    if (len % 2 == 1) {
+        outAddr(out, img->dataBase + offset + len - 1);
+        outWrite(out, ": .data1 ", 9);
+        outHex(out, (char *)bytes + len - 1, 1);
+        outChar(out, '\n');
+    }
+}
+
+static unsigned int nextMark(Image *img, char *marks, unsigned int offset, char mark)
+{
+    while (offset < img->dataLen && !(marks[offset] & mark))
+        ++offset;
+    return offset;
+}
+
+int dumpData(OutBuffer *out, Image *img)
+{
+    char *marks = calloc(img->dataLen + 1, 1);
+    if (marks == NULL)
+        return 1;
+
+    for (int i = 0; i < img->syms.count; ++i)
+        if (img->syms.syms[i].sect == N_DATA)
+            markRef(img, marks, img->syms.syms[i].value, MARK_SYMBOL);
+    collectDataRefs(img, marks);
+
+    outWrite(out, "\n.sect .data\n", 13);
+    unsigned int offset = 0;
+    int labeled = 0;
+    while (offset < img->dataLen) {
+        unsigned int end = nextMark(img, marks, offset + 1, MARK_REF | MARK_SYMBOL);
+
+        if (marks[offset]) {
+            dumpLabel(out, img, offset);
+            labeled = 1;
+        }
+
+        if (!labeled) {
+            for (unsigned int i = offset; i < end; i += DATA_LINE_LEN) {
+                dumpHexLine(out, img, i, end - i < DATA_LINE_LEN ? end - i : DATA_LINE_LEN);
+                outMaybeFlush(out);
+            }
+            offset = end;
+            continue;
+        }
+
+        // a string runs over the references into it (hello+1), up to the next symbol
+        unsigned int symbolEnd = nextMark(img, marks, offset + 1, MARK_SYMBOL);
+        int len = asciiRunLength(img->data + offset, symbolEnd - offset, DATA_ASCII_MIN_LEN);
+        if (len > 0) {
+            dumpAscii(out, img->dataBase + offset, img->data + offset, len);
+            offset += len;
+            continue;
+        }
+
+        // words up to the next label or string
+        unsigned int next = offset + 2;
+        while (next < end && asciiRunLength(img->data + next, end - next, DATA_ASCII_MIN_LEN) == 0)
+            next += 2;
+        if (next > end)
+            next = end;
+        dumpWords(out, img, offset, next - offset);
+        outMaybeFlush(out);
+        offset = next;
+    }
+    if (img->hdr.bsslen > 0) {
+        char line[32];
+        outWrite(out, "\n.sect .bss\n", 12);
+        outAddr(out, img->dataBase + img->dataLen);
+        outWrite(out, line, snprintf(line, sizeof(line), ": .space %d\n", img->hdr.bsslen));
+    }
+
+    free(marks);
+    return 0;
+}
@@ -0,0 +1,66 @@
+#ifndef DATADUMP_H
+#define DATADUMP_H
+
+#include "image.h"
+#include "output.h"
+
+/*
+ * --- DATA DUMP ---
+ *
+ * The data segment is listed as hexdump + ASCII lines, 16 bytes each.
+ * From every address a label points to (a data symbol, or a reference
+ * found in the text : mov immediates, direct [disp] operands and the
+ * accumulator moves), the bytes get a typed view instead :
+ *   .ascii "..." for printable strings
+ *   .data2 for words, .data1 for an odd last byte
+ * The bss segment is only a size.
+ */
+
+#define DATA_LINE_LEN 16
+#define DATA_WORDS_PER_LINE 8
+#define DATA_ASCII_PER_LINE 32
+#define DATA_ASCII_MIN_LEN 3
+
+#define isPrintable(c) (((c) >= 0x20 && (c) < 0x7f) || (c) == '\n' || (c) == '\t' || (c) == '\r')
+
+/**
+ * @brief Find the addresses the text segment references in the data segment
+ *
+ * @param img Image*
+ * @param marks char* dataLen + 1 flags, marked at each referenced offset
+ * @return int 0 on success, 1 on error
+ */
+int collectDataRefs(Image *img, char *marks);
+
+/**
+ * @brief Length of the string at the start of bytes : at least minLen
+ * printable bytes, ended by a zero (counted) or by the end of bytes
+ *
+ * @param bytes const char*
+ * @param len unsigned int
+ * @param minLen unsigned int
+ * @return unsigned int 0 if there is no such string
+ */
+unsigned int asciiRunLength(const char *bytes, unsigned int len, unsigned int minLen);
+
+/**
+ * @brief List bytes as .ascii lines of DATA_ASCII_PER_LINE characters,
+ * with \n \t \r \0 \" and \\ escaped
+ *
+ * @param out OutBuffer*
+ * @param addr unsigned int of the first byte
+ * @param bytes const char*
+ * @param len int
+ */
+void dumpAscii(OutBuffer *out, unsigned int addr, const char *bytes, int len);
+
+/**
+ * @brief List the data and bss segments
+ *
+ * @param out OutBuffer*
+ * @param img Image*
+ * @return int 0 on success, 1 on error
+ */
+int dumpData(OutBuffer *out, Image *img);
+
+#endif
@@ -0,0 +1,347 @@
+#include "diff.h"
+#include "disasembler.h"
+#include "image.h"
+#include "output.h"
+#include "records.h"
+#include "symbols.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct DiffStruct {
+    const uint64_t *a;
+    const uint64_t *b;
+    char *changedA;
+    char *changedB;
+    int *fv; // furthest forward x on each diagonal
+    int *bv; // furthest backward x on each diagonal
+    int off; // index of diagonal 0, diagonals are in [-m - 1, n + 1]
+} Diff;
+
+static uint64_t hashBytes(uint64_t h, const void *bytes, size_t len)
+{
+    const unsigned char *p = bytes;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= FNV_PRIME;
+    }
+    return h;
+}
+
+/*
+ * End of the middle snake of a[aLo, aHi) b[bLo, bHi), in absolute
+ * coordinates. Diagonal k holds the points x - y = k; the forward search
+ * starts on diagonal 0 and the backward one on delta = n - m, each
+ * widened by one diagonal per edit but never past the diagonals of the
+ * rectangle, [-m, n], which a search of very unequal lengths reaches
+ * first. The diagonal just outside the searched ones holds a sentinel.
+ */
+static void middleSnake(Diff *d, int aLo, int aHi, int bLo, int bHi, int *sx, int *sy)
+{
+    const uint64_t *a = d->a + aLo, *b = d->b + bLo;
+    int n = aHi - aLo, m = bHi - bLo;
+    int delta = n - m, odd = delta & 1;
+    int *fv = d->fv + d->off, *bv = d->bv + d->off;
+    int fmin = 0, fmax = 0, bmin = delta, bmax = delta;
+
+    fv[0] = 0;
+    bv[delta] = n;
+    for (int D = 1;; ++D) {
+        if (fmin > -m)
+            fv[--fmin - 1] = -1;
+        else
+            ++fmin;
+        if (fmax < n)
+            fv[++fmax + 1] = -1;
+        else
+            --fmax;
+        for (int k = fmax; k >= fmin; k -= 2) {
+            int x = fv[k - 1] < fv[k + 1] ? fv[k + 1] : fv[k - 1] + 1;
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y])
+                ++x, ++y;
+            fv[k] = x;
+            if (odd && k >= bmin && k <= bmax && bv[k] <= x) {
+                *sx = aLo + x;
+                *sy = bLo + y;
+                return;
+            }
+        }
+
+        if (bmin > -m)
+            bv[--bmin - 1] = INT_MAX;
+        else
+            ++bmin;
+        if (bmax < n)
+            bv[++bmax + 1] = INT_MAX;
+        else
+            --bmax;
+        for (int k = bmax; k >= bmin; k -= 2) {
+            int x = bv[k - 1] < bv[k + 1] ? bv[k - 1] : bv[k + 1] - 1;
+            int y = x - k;
+            while (x > 0 && y > 0 && a[x - 1] == b[y - 1])
+                --x, --y;
+            bv[k] = x;
+            if (!odd && k >= fmin && k <= fmax && x <= fv[k]) {
+                *sx = aLo + x;
+                *sy = bLo + y;
+                return;
+            }
+        }
+
+        if (D >= DIFF_MAX_COST) {
+            // too expensive : split at the forward path that got the furthest
+            int bestX = 0, bestY = 0;
+            for (int k = fmax; k >= fmin; k -= 2) {
+                int x = fv[k] < n ? fv[k] : n;
+                int y = x - k;
+                if (y > m) {
+                    x = m + k;
+                    y = m;
+                }
+                if (x + y > bestX + bestY) {
+                    bestX = x;
+                    bestY = y;
+                }
+            }
+            *sx = aLo + bestX;
+            *sy = bLo + bestY;
+            return;
+        }
+    }
+}
+
+static void compareRanges(Diff *d, int aLo, int aHi, int bLo, int bHi)
+{
+    while (aLo < aHi && bLo < bHi && d->a[aLo] == d->b[bLo])
+        ++aLo, ++bLo;
+    while (aLo < aHi && bLo < bHi && d->a[aHi - 1] == d->b[bHi - 1])
+        --aHi, --bHi;
+
+    if (aLo == aHi) {
+        memset(d->changedB + bLo, 1, bHi - bLo);
+    } else if (bLo == bHi) {
+        memset(d->changedA + aLo, 1, aHi - aLo);
+    } else {
+        int x, y;
+        middleSnake(d, aLo, aHi, bLo, bHi, &x, &y);
+        if ((x == aLo && y == bLo) || (x == aHi && y == bHi)) {
+            // no progress, only possible after a cost cut
+            memset(d->changedA + aLo, 1, aHi - aLo);
+            memset(d->changedB + bLo, 1, bHi - bLo);
+            return;
+        }
+        compareRanges(d, aLo, x, bLo, y);
+        compareRanges(d, x, aHi, y, bHi);
+    }
+}
+
+int diffSequences(const uint64_t *a, int n, const uint64_t *b, int m, char *changedA, char *changedB)
+{
+    Diff d = {a, b, changedA, changedB};
+    d.off = m + 1;
+    d.fv = malloc(sizeof(int) * (n + m + 3));
+    d.bv = malloc(sizeof(int) * (n + m + 3));
+    if (d.fv == NULL || d.bv == NULL) {
+        free(d.fv);
+        free(d.bv);
+        return 1;
+    }
+
+    memset(changedA, 0, n);
+    memset(changedB, 0, m);
+    compareRanges(&d, 0, n, 0, m);
+
+    free(d.fv);
+    free(d.bv);
+    return 0;
+}
+
+/**
+ * @brief Hash the records of an image, a relative target ($P) is hashed as
+ * the symbol there or else as the instructions found there
+ */
+static uint64_t *hashRecords(Image *img, DecodedText *dec)
+{
+    unsigned int count = dec->count;
+    uint64_t *hashes = malloc(sizeof(uint64_t) * (count ? count : 1));
+    uint64_t *plain = malloc(sizeof(uint64_t) * (count ? count : 1));
+    if (hashes == NULL || plain == NULL) {
+        free(hashes);
+        free(plain);
+        return NULL;
+    }
+
+    // first pass, the instructions without their displacement
+    for (unsigned int i = 0; i < count; ++i) {
+        Record rec = getRecord(dec, i);
+        unsigned int target;
+        int dispLen = recordTarget(&rec, img->text, &target);
+        uint64_t h = hashBytes(FNV_OFFSET, &rec.typeId, 1);
+        plain[i] = hashBytes(h, img->text + rec.offset, rec.length - dispLen);
+    }
+
+    for (unsigned int i = 0; i < count; ++i) {
+        Record rec = getRecord(dec, i);
+        unsigned int target;
+        uint64_t h = plain[i];
+        if (recordTarget(&rec, img->text, &target) > 0) {
+            const Symbol *sym = findSymbolAt(&img->syms, N_TEXT, target);
+            unsigned int j = findRecord(dec, target);
+            if (sym) {
+                h = hashBytes(h, "s", 1);
+                h = hashBytes(h, sym->name, strlen(sym->name));
+            } else if (dec->offsets[j] == target) {
+                h = hashBytes(h, "i", 1);
+                for (unsigned int k = j; k < j + DIFF_TARGET_SPAN && k < count; ++k)
+                    h = hashBytes(h, &plain[k], sizeof(plain[k]));
+            } else {
+                // into the middle of an instruction, keep the distance
+                int distance = (int)target - (int)rec.offset;
+                h = hashBytes(h, "b", 1);
+                h = hashBytes(h, &distance, sizeof(distance));
+            }
+        }
+        hashes[i] = h;
+    }
+    free(plain);
+    return hashes;
+}
+
+static void diffLine(OutBuffer *out, char mark, Image *img, DecodedText *dec, int i)
+{
+    Instruction instr = recordInstruction(dec, img->text, i);
+    outChar(out, mark);
+    formatInstruction(out, dec->offsets[i], &instr);
+    outMaybeFlush(out);
+}
+
+static void diffHunkHeader(OutBuffer *out, int aStart, int aLen, int bStart, int bLen)
+{
+    char line[64];
+    // unified diff numbers empty ranges from the line before
+    outWrite(out, line, snprintf(line, sizeof(line), "@@ -%d,%d +%d,%d @@\n",
+                                 aLen ? aStart + 1 : aStart, aLen, bLen ? bStart + 1 : bStart, bLen));
+}
+
+static void printHunks(OutBuffer *out, Image *imgA, DecodedText *decA, char *changedA,
+                       Image *imgB, DecodedText *decB, char *changedB)
+{
+    int n = decA->count, m = decB->count;
+    int i = 0, j = 0;
+
+    while (i < n || j < m) {
+        // skip to the next change
+        while (i < n && j < m && !changedA[i] && !changedB[j])
+            ++i, ++j;
+        if (i >= n && j >= m)
+            break;
+
+        int aStart = i - DIFF_CONTEXT < 0 ? 0 : i - DIFF_CONTEXT;
+        int bStart = j - (i - aStart);
+
+        // extend the hunk while the changes are less than 2 contexts apart
+        int aEnd = i, bEnd = j;
+        for (;;) {
+            while (aEnd < n && changedA[aEnd])
+                ++aEnd;
+            while (bEnd < m && changedB[bEnd])
+                ++bEnd;
+            int same = 0;
+            while (aEnd + same < n && bEnd + same < m && !changedA[aEnd + same] &&
+                   !changedB[bEnd + same] && same <= 2 * DIFF_CONTEXT)
+                ++same;
+            if ((aEnd + same < n && changedA[aEnd + same]) || (bEnd + same < m && changedB[bEnd + same])) {
+                if (same <= 2 * DIFF_CONTEXT) {
+                    aEnd += same;
+                    bEnd += same;
+                    continue;
+                }
+            }
+            int context = same < DIFF_CONTEXT ? same : DIFF_CONTEXT;
+            aEnd += context;
+            bEnd += context;
+            break;
+        }
+
+        diffHunkHeader(out, aStart, aEnd - aStart, bStart, bEnd - bStart);
+        int x = aStart, y = bStart;
+        while (x < aEnd || y < bEnd) {
+            if (x < aEnd && changedA[x]) {
+                diffLine(out, '-', imgA, decA, x++);
+            } else if (y < bEnd && changedB[y]) {
+                diffLine(out, '+', imgB, decB, y++);
+            } else {
+                diffLine(out, ' ', imgA, decA, x++);
+                ++y;
+            }
+        }
+        i = aEnd;
+        j = bEnd;
+    }
+}
+
+static int decodeImage(const char *path, Image *img, DecodedText *dec)
+{
+    if (openImage(path, img) != 0)
+        return 1;
+    if (initDecodedText(dec, img->textLen / 3) != 0) {
+        closeImage(img);
+        return 1;
+    }
+    if (decodeText(img->text, img->textLen, dec) != 0) {
+        printf("cannot decode %s\n", path);
+        freeDecodedText(dec);
+        closeImage(img);
+        return 1;
+    }
+    return 0;
+}
+
+int diffImages(const char *pathA, const char *pathB, FILE *file)
+{
+    Image imgA, imgB;
+    DecodedText decA, decB;
+    if (decodeImage(pathA, &imgA, &decA) != 0)
+        return 2;
+    if (decodeImage(pathB, &imgB, &decB) != 0) {
+        freeDecodedText(&decA);
+        closeImage(&imgA);
+        return 2;
+    }
+
+    int status = 2;
+    uint64_t *hashA = hashRecords(&imgA, &decA);
+    uint64_t *hashB = hashRecords(&imgB, &decB);
+    char *changedA = malloc(decA.count + 1);
+    char *changedB = malloc(decB.count + 1);
+    OutBuffer out;
+
+    if (hashA && hashB && changedA && changedB &&
+        diffSequences(hashA, decA.count, hashB, decB.count, changedA, changedB) == 0 &&
+        initOutBuffer(&out, file, OUT_BUFFER_SIZE) == 0) {
+        status = memchr(changedA, 1, decA.count) != NULL || memchr(changedB, 1, decB.count) != NULL;
+        if (status) {
+            outWrite(&out, "--- ", 4);
+            outStr(&out, pathA);
+            outWrite(&out, "\n+++ ", 5);
+            outStr(&out, pathB);
+            outChar(&out, '\n');
+            printHunks(&out, &imgA, &decA, changedA, &imgB, &decB, changedB);
+        }
+        freeOutBuffer(&out);
+    }
+
+    free(hashA);
+    free(hashB);
+    free(changedA);
+    free(changedB);
+    freeDecodedText(&decA);
+    freeDecodedText(&decB);
+    closeImage(&imgA);
+    closeImage(&imgB);
+    return status;
+}
@@ -0,0 +1,45 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * --- DIFF ---
+ *
+ * dis diff A B : unified diff of the listings of two builds.
+ * Every instruction is hashed with its relative target ($P) replaced by a
+ * label that does not move when code is inserted elsewhere : the text
+ * symbol at the target, or else the first instructions found there.
+ * The hash sequences are aligned with Myers' O(ND) algorithm in linear
+ * space (middle snake bisection).
+ */
+
+#define DIFF_CONTEXT 3
+#define DIFF_TARGET_SPAN 3 // instructions hashed for a target without symbol
+#define DIFF_MAX_COST 4096 // past this many edits a split may not be minimal
+
+/**
+ * @brief Find a shortest edit script between two sequences
+ *
+ * @param a const uint64_t*
+ * @param n int
+ * @param b const uint64_t*
+ * @param m int
+ * @param changedA char* n flags, set to 1 for deleted elements
+ * @param changedB char* m flags, set to 1 for inserted elements
+ * @return int 0 on success, 1 on allocation failure
+ */
+int diffSequences(const uint64_t *a, int n, const uint64_t *b, int m, char *changedA, char *changedB);
+
+/**
+ * @brief Print the instruction level diff of two a.out files
+ *
+ * @param pathA const char*
+ * @param pathB const char*
+ * @param file FILE*
+ * @return int 0 if same, 1 if different, 2 on error
+ */
+int diffImages(const char *pathA, const char *pathB, FILE *file);
+
+#endif
@@ -1,39 +1,22 @@
 #include "disasembler.h"
+#include "hexfmt.h"
 #include "instruction.h"
+#include "output.h"
+#include "profile.h"
+#include "syntax.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define isBit(a) ((a) == 0 || (a) == 1)
 
-const char hexChars[16] = {'0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'};
-
-char *replacedStr(char *source, char *target, char *newStr)
-{
-    int len = strlen(source) - strlen(target) + strlen(newStr);
-    char *res = (char *)malloc(len + 1);
-    for (int is = 0, ir = 0; is < strlen(source); ++is, ++ir) {
-        int targetFound = 1;
-        for (int j = 0; j < strlen(target); ++j)
-            if (source[is + j] != target[j] || is + j >= strlen(source))
-                targetFound = 0;
-        if (targetFound) {
-            for (int j = 0; j < strlen(newStr); ++j) {
-                res[ir + j] = newStr[j];
-            }
-            is += strlen(target) - 1;
-            ir += strlen(newStr) - 1;
-        } else {
-            res[ir] = source[is];
-        }
-    }
-    return res;
-}
-
 char *replacedStrField(char *source, char field, char *newStr)
 {
-    int len = strlen(source) - 3 + strlen(newStr);
+    int len = strlen(source) - 2 + strlen(newStr);
     char *res = (char *)malloc(len + 1);
+    res[len] = '\0';
     for (int is = 0, ir = 0; is < strlen(source); ++is, ++ir) {
         if (source[is] == '$' && source[is + 1] == field) {
             for (int j = 0; j < strlen(newStr); ++j) {
@@ -51,10 +34,7 @@ char *replacedStrField(char *source, char field, char *newStr)
 char *byteFormatHex(char *bytes, int len)
 {
     char *res = malloc(2 * len + 1);
-    for (int i = 0; i < len; ++i) {
-        res[2 * i] = hexChars[(bytes[i] >> 4) & 0xf];
-        res[2 * i + 1] = hexChars[bytes[i] & 0xf];
-    }
+    hexEncode(res, (unsigned char *)bytes, len);
     res[2 * len] = '\0';
     return res;
 }
@@ -62,10 +42,7 @@ char *byteFormatHex(char *bytes, int len)
 char *byteFormatRevHex(char *bytes, int len)
 {
     char *res = malloc(2 * len + 1);
-    for (int i = 0; i < len; ++i) {
-        res[2 * i] = hexChars[(bytes[len - i - 1] >> 4) & 0xf];
-        res[2 * i + 1] = hexChars[bytes[len - i - 1] & 0xf];
-    }
+    hexEncodeRev(res, (unsigned char *)bytes, len);
     res[2 * len] = '\0';
     return res;
 }
@@ -75,10 +52,10 @@ char *stripLeadingZeros(char *str)
     int c = 0;
     while (str[c] == '0')
         ++c;
-    if (str[c] == '\0')
+    if (str[c] == '\0' && c > 0)
         --c;
-    for (int j = 0; str[j + c - 1]; ++j)
-        str[j] = str[j + c];
+    if (c > 0)
+        memmove(str, str + c, strlen(str + c) + 1);
     return str;
 }
 
@@ -177,12 +154,41 @@ const char **splitCodeFormatTo(const InstructionType *instrType, const char **pa
     return parts;
 }
 
+/*
+ * Decode dispatch : the code formats are split once, and for each first
+ * byte only the types whose first part can match it are tried, in table
+ * order, so the first match is the same as with a scan of all the types.
+ */
+static const char *typeParts[NUM_OF_INSTRUCT_TYPES][MAX_INSTRUCT_LEN];
+static FieldMask wFields[NUM_OF_INSTRUCT_TYPES], WFields[NUM_OF_INSTRUCT_TYPES]; // operand size, for the lengths
+static uint8_t candidates[256][NUM_OF_INSTRUCT_TYPES];
+static uint8_t numCandidates[256];
+static pthread_once_t dispatchOnce = PTHREAD_ONCE_INIT;
+
+static void initDispatch(void)
+{
+    for (int i = 0; i < NUM_OF_INSTRUCT_TYPES; ++i) {
+        splitCodeFormatTo(&(instructionTypes[i]), typeParts[i]);
+        wFields[i] = compileField(instructionTypes + i, 'w');
+        WFields[i] = compileField(instructionTypes + i, 'W');
+    }
+    for (int byte = 0; byte < 256; ++byte)
+        for (int i = 0; i < NUM_OF_INSTRUCT_TYPES; ++i)
+            if (byteMatch(byte, typeParts[i][0]) != 0)
+                candidates[byte][numCandidates[byte]++] = i;
+}
+
+const char **getTypeParts(const InstructionType *instrType)
+{
+    pthread_once(&dispatchOnce, initDispatch);
+    return typeParts[instrType - instructionTypes];
+}
+
 int calcInstrLength(Instruction *instr)
 {
-    const char **codeFormatParts = splitCodeFormat(instr->type);
-    int res = calcInstrLengthFrom(instr, codeFormatParts);
-    free(codeFormatParts);
-    return res;
+    if (instr->type == NULL)
+        return 0;
+    return calcInstrLengthFrom(instr, getTypeParts(instr->type));
 }
 
 int calcInstrLengthFrom(Instruction *instr, const char **codeFormatParts)
@@ -190,6 +196,9 @@ int calcInstrLengthFrom(Instruction *instr, const char **codeFormatParts)
     if (instr->type == NULL)
         return 0;
 
+    // the size fields are in the first opcode byte, the only one a sized type has
+    int t = instr->type - instructionTypes;
+    const unsigned char *data = (const unsigned char *)instr->data;
     int length = 0, partLength;
     const char *part;
     for (int i = 0; codeFormatParts[i] != NULL; ++i) {
@@ -198,19 +207,13 @@ int calcInstrLengthFrom(Instruction *instr, const char **codeFormatParts)
         if (part[0] == '(') {
             switch (part[1]) {
             case 'R':
-                partLength = 1;
-                char mod, rxm;
-                decomposeRegMem(*(instr->data + length), &mod, NULL, &rxm);
-                if (mod == 0b01)
-                    partLength = 2;
-                else if ((mod == 0b00 && rxm == 0b110) || mod == 0b10)
-                    partLength = 3;
+                partLength = 1 + modRMTable[(unsigned char)instr->data[length]].dispLen;
                 break;
             case 'D':
             case 'a':
             case 'P':
                 partLength = 1;
-                if (part[2] == 'w' || (getField(instr, 'w') | getField(instr, 'W')) == 1)
+                if (part[2] == 'w' || (fieldValue(wFields[t], data, 1) | fieldValue(WFields[t], data, 1)) == 1)
                     partLength = 2;
                 break;
             case 'p':
@@ -236,11 +239,13 @@ int calcInstrLengthFrom(Instruction *instr, const char **codeFormatParts)
 Instruction readInstruction(char *text, int textLen, unsigned int pos)
 {
     Instruction res = {NULL, text + pos, 0, {0}};
-    const char **codeFormatParts = malloc(sizeof(char *) * MAX_INSTRUCT_LEN);
+    pthread_once(&dispatchOnce, initDispatch);
 
-    for (int i = 0; i < NUM_OF_INSTRUCT_TYPES; ++i) {
-        int currentPos = 0, isMatch = 1, status;
-        splitCodeFormatTo(&(instructionTypes[i]), codeFormatParts);
+    unsigned char first = text[pos];
+    for (int c = 0; c < numCandidates[first]; ++c) {
+        int i = candidates[first][c];
+        const char **codeFormatParts = typeParts[i];
+        int currentPos = 1, isMatch = 1, status;
         while (pos + currentPos < textLen) {
             status = byteMatch(*(text + pos + currentPos), codeFormatParts[currentPos]);
             if (status == 1) {
@@ -255,8 +260,10 @@ Instruction readInstruction(char *text, int textLen, unsigned int pos)
 
         if (isMatch) {
             res.type = instructionTypes + i;
+            PROFILE_BEGIN(PROF_LENGTH);
             calcInstrLengthFrom(&res, codeFormatParts);
-            if (pos + res.length >= textLen) {
+            PROFILE_END(PROF_LENGTH);
+            if (pos + res.length > textLen) {
                 res.length = textLen - pos;
                 res.type = NULL;
             }
@@ -264,245 +271,81 @@ Instruction readInstruction(char *text, int textLen, unsigned int pos)
         }
     }
 
-    free(codeFormatParts);
     return res;
 }
 
-char *getDisp(char mod, char rxm, int pos, Instruction *instr)
+int printInstruction(unsigned int pos, Instruction *instr)
 {
-    char *res;
-    if (mod == 0b00) {
-        if (rxm == 0b110) { // EA = disph, displ
-            char disp[2];
-            disp[0] = instr->data[pos + 2];
-            disp[1] = instr->data[pos + 1];
-            res = byteFormatHex(disp, 2);
-        } else { // disp = 0
-            res = malloc(1);
-            res[0] = '\0';
-        }
-    } else if (mod == 0b01) { // disp = displ sign extended to word
-        res = malloc(4);
-        if ((instr->data[pos + 1] & 0x80) == 0) {
-            res[0] = '+';
-            char *tmp = stripLeadingZeros(byteFormatHex(&instr->data[pos + 1], 1));
-            strcpy(res + 1, tmp);
-            free(tmp);
-        } else {
-            res[0] = '-';
-            char twoComp = (instr->data[pos + 1] ^ 0xff) + 1;
-            char *tmp = stripLeadingZeros(byteFormatHex(&twoComp, 1));
-            strcpy(res + 1, tmp);
-            free(tmp);
-        }
-    } else if (mod == 0b10) { // disp = disph, displ
-        res = malloc(6);
-        res[0] = '+';
-        char disp[2];
-        disp[0] = instr->data[pos + 2];
-        disp[1] = instr->data[pos + 1];
-        char *tmp = stripLeadingZeros(byteFormatHex(disp, 2));
-        strcpy(res + 1, tmp);
-        free(tmp);
-    } else { // if (mod == 0b11) { // r/m is treated as a reg field
-        res = malloc(1);
-        res[0] = '\0';
-    }
-    return res;
+    OutBuffer out;
+    if (initOutBuffer(&out, stdout, 128) != 0)
+        return 1;
+    formatInstruction(&out, pos, instr);
+    freeOutBuffer(&out);
+    return 0;
 }
 
-int printInstruction(unsigned int pos, Instruction *instr)
+int formatInstruction(OutBuffer *out, unsigned int pos, Instruction *instr)
 {
-    char *value = byteFormatHex(instr->data, instr->length);
-    printf("%04x: %-13s ", pos, value);
-    free(value);
+    PROFILE_BEGIN(PROF_FORMAT);
+    outLinePrefix(out, pos, instr->data, instr->length);
 
     if (instr->type == NULL) {
-        printf("(undefined)\n");
+        outWrite(out, "(undefined)\n", 12);
+        PROFILE_END(PROF_FORMAT);
         return 0;
     }
 
-    char fields[NUM_OF_PRINTFMT_FIELDS] = {'\0'};
-    char *datas[NUM_OF_INSTRUCT_TYPES] = {NULL};
-    for (int i = 0, j = 0; instr->type->printFormat[i + 1] != '\0'; ++i) {
-        if (instr->type->printFormat[i] == '$')
-            fields[j++] = instr->type->printFormat[i + 1];
-    }
-
-    const char **codeFormatParts = splitCodeFormat(instr->type);
-
-    char c, *data;
-    for (int i = 0; i < NUM_OF_PRINTFMT_FIELDS && fields[i]; ++i) {
-        c = fields[i];
-        switch (c) {
-
-        case 'R':
-            char mod = 0, rxm = 0;
-            int j, k;
-            for (j = 0, k = 0; j < MAX_INSTRUCT_LEN;
-                 k += instr->partsLengths[j], ++j) {
-                if (codeFormatParts[j][0] == '(' && codeFormatParts[j][1] == 'R') {
-                    decomposeRegMem(instr->data[k], &mod, NULL, &rxm);
-                    break;
-                }
-            }
-
-            if (mod == 0b11) {
-                int w = 1;
-                if (fieldExists(instr->type, 'w') | fieldExists(instr->type, 'W'))
-                    w = getField(instr, 'w') | getField(instr, 'W');
-                data = getRegPrintStr(rxm, w);
-            } else {
-                char *tmp = getRegMemPrintStr(mod, rxm);
-                char *disp = getDisp(mod, rxm, k, instr);
-                data = replacedStr(tmp, "+disp", disp);
-                free(tmp);
-                free(disp);
-            }
-            break;
-
-        case 'r':
-        case 's':
-            char reg;
-            if (fieldExists(instr->type, c)) {
-                reg = getField(instr, c);
-            } else {
-                for (int j = 0, k = 0; j < MAX_INSTRUCT_LEN; k += instr->partsLengths[j], ++j) {
-                    if (codeFormatParts[j][0] == '(' && codeFormatParts[j][1] == 'R' && codeFormatParts[j][2] == c) {
-                        decomposeRegMem(instr->data[k], NULL, &reg, NULL);
-                        break;
-                    }
-                }
-            }
-            if (c == 'r') {
-                int w = 1;
-                if (fieldExists(instr->type, 'w') | fieldExists(instr->type, 'W'))
-                    w = getField(instr, 'w') | getField(instr, 'W');
-                data = getRegPrintStr(reg, w);
-            } else if (c == 's') {
-                data = getSegPrintStr(reg);
-            }
-            break;
-
-        case 'P':
-        case 'D':
-        case 'a':
-        case 'p':
-        case 'o':
-        case 'i':
-            int isRD = 0;
-            for (int j = 0, k = 0; j < MAX_INSTRUCT_LEN; k += instr->partsLengths[j], ++j) {
-                if (codeFormatParts[j][0] == '(' && codeFormatParts[j][1] == 'R')
-                    isRD = 1;
-                if (codeFormatParts[j][0] == '(' && codeFormatParts[j][1] == c) { // "(D)", "(a)", ...
-                    if (c == 'D') {
-                        if (isRD == 1 && (!fieldExists(instr->type, 'W') ||
-                                          ((getField(instr, 'W') & 0b10) == 0b10))) {
-                            data = byteFormatRevHex(instr->data + k, instr->partsLengths[j]);
-                            data = stripLeadingZeros(data);
-                        } else {
-                            data = byteFormatRevHex(instr->data + k, instr->partsLengths[j]);
-                        }
-                    } else if (c == 'P') {
-                        char offset[2];
-
-                        int offsetByte = instr->data[k] & 0xff;
-                        if (codeFormatParts[j][2] == 'w') {
-                            offsetByte += (instr->data[k + 1] << 8) & 0xffff;
-                            offsetByte += (pos + instr->length) & 0xffff;
-                        } else {
-                            if ((offsetByte & 0x80) == 0) {
-                                offsetByte = ((pos + instr->length) & 0xffff) + offsetByte;
-                            } else {
-                                offsetByte = ((pos + instr->length) & 0xffff) - ((offsetByte ^ 0xff) + 0x1);
-                            }
-                        }
-                        offset[0] = (offsetByte >> 8) & 0xff;
-                        offset[1] = offsetByte & 0xff;
-                        data = byteFormatHex(offset, 2);
-                    } else {
-                        data = byteFormatHex(instr->data + k, instr->partsLengths[j]);
-                    }
-                    break;
-                }
-            }
-            break;
-
-        case 'w':
-            int w = getField(instr, 'w') | getField(instr, 'W');
-            data = malloc(2);
-            data[0] = (w == 0) ? 'l' : 'x';
-            data[1] = '\0';
-            break;
-
-        case 'c':
-            data = malloc(3);
-            strcpy(data, getField(instr, 'r') == 0 ? "1" : "CL");
-            break;
-
-        default:
-            data = malloc(1);
-            data[0] = '\0';
-            break;
-        }
-
-        datas[i] = data;
-    }
+    formatOperands(out, pos, instr);
+    PROFILE_END(PROF_FORMAT);
+    return 0;
+}
 
-    // switch r/m and reg or seg bits if the direction bit is 1
-    if (fieldExists(instr->type, 'd') && getField(instr, 'd') == 1) {
-        int posR = 0, posrs = 0;
-        for (int i = 0; fields[i] != '\0'; ++i) {
-            if (fields[i] == 'R')
-                posR = i;
-            if (fields[i] == 'r' || fields[i] == 's')
-                posrs = i;
+int disassembleText(OutBuffer *out, char *text, int textLen, ListingStats *stats)
+{
+    unsigned int pos = 0;
+    while (pos < textLen) {
+        PROFILE_BEGIN(PROF_DECODE);
+        Instruction res = readInstruction(text, textLen, pos);
+        PROFILE_END(PROF_DECODE);
+        PROFILE_COUNT(PROF_INSTRUCTIONS, 1);
+        // if (res.type == NULL) {
+        //     printf("instruction has no match\n");
+        //     return 1;
+        // }
+        if (res.length == 0) {
+            // in the listing, which may not go to stdout
+            outStr(out, "zero length instruction\n");
+            outFlush(out);
+            return 1;
         }
-
-        fields[posR] = fields[posrs];
-        fields[posrs] = 'R';
-    }
-
-    char *res = malloc(33);
-    strcpy(res, instr->type->printFormat);
-    for (int i = 0; i < NUM_OF_PRINTFMT_FIELDS && fields[i]; ++i) {
-        char *newRes = replacedStrField(res, fields[i], datas[i]);
-        free(res);
-        res = newRes;
-        free(datas[i]);
+        countListed(stats, res.type == NULL);
+        formatInstruction(out, pos, &res);
+        outMaybeFlush(out);
+        pos += res.length;
     }
-
-    printf("%s\n", res);
-
-    free(codeFormatParts);
     return 0;
 }
 
 int readText(FILE *file, Header *hdr)
 {
+    PROFILE_BEGIN(PROF_LOAD);
     char *text = malloc(hdr->textlen);
     fseek(file, hdr->hdrlen, SEEK_SET);
 
     for (int i = 0; i < hdr->textlen; ++i)
         *(text + i) = getc(file);
+    PROFILE_END(PROF_LOAD);
+    PROFILE_COUNT(PROF_BYTES, hdr->textlen);
 
-    unsigned int pos = 0;
-    while (pos < hdr->textlen) {
-        Instruction res = readInstruction(text, hdr->textlen, pos);
-        // if (res.type == NULL) {
-        //     printf("instruction has no match\n");
-        //     free(text);
-        //     return 1;
-        // }
-        if (res.length == 0) {
-            printf("zero length instruction\n");
-            free(text);
-            return 1;
-        }
-        printInstruction(pos, &res);
-        pos += res.length;
+    OutBuffer out;
+    if (initOutBuffer(&out, stdout, OUT_BUFFER_SIZE) != 0) {
+        free(text);
+        return 1;
     }
 
+    int status = disassembleText(&out, text, hdr->textlen, NULL);
+
+    freeOutBuffer(&out);
     free(text);
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
\ No newline at end of file
@@ -3,18 +3,9 @@
 
 #include "header.h"
 #include "instruction.h"
+#include "output.h"
 #include <stdio.h>
 
-/**
- * @brief 
- * 
- * @param source 
- * @param target 
- * @param newStr 
- * @return char* 
- */
-char *replacedStr(char *source, char *target, char *newStr);
-
 /**
  * @brief 
  * 
@@ -108,7 +99,15 @@ const char** splitCodeFormat(const InstructionType* instrType);
 const char** splitCodeFormatTo(const InstructionType* instrType, const char **parts);
 
 /**
- * @brief Get the length of the instruction
+ * @brief The parts of the code format of a type, split once and shared
+ * 
+ * @param instrType const InstructionType*
+ * @return const char** the parts, not to be freed
+ */
+const char** getTypeParts(const InstructionType* instrType);
+
+/**
+ * @brief Get the length of the instruction, from the shared parts
  * 
  * @param instr 
  * @return int the length
@@ -135,24 +134,58 @@ int calcInstrLengthFrom(Instruction *instr, const char **codeFormatParts);
 Instruction readInstruction(char *text, int textLen, unsigned int pos);
 
 /**
- * @brief Get the Disp object
+ * @brief 
  * 
- * @param mod 
- * @param rxm 
  * @param pos 
  * @param instr 
- * @return char* 
+ * @return int 
  */
-char *getDisp(char mod, char rxm, int pos, Instruction *instr);
+int printInstruction(unsigned int pos, Instruction* instr);
 
 /**
- * @brief 
+ * @brief Format the listing line of an instruction
  * 
- * @param pos 
- * @param instr 
+ * @param out OutBuffer* where to write the line
+ * @param pos unsigned int
+ * @param instr Instruction*
  * @return int 
  */
-int printInstruction(unsigned int pos, Instruction* instr);
+int formatInstruction(OutBuffer *out, unsigned int pos, Instruction *instr);
+
+/**
+ * @brief The instructions a listing went through
+ * @param instructions unsigned long
+ * @param undefined unsigned long of no known type
+ */
+typedef struct ListingStatsStruct {
+    unsigned long instructions;
+    unsigned long undefined;
+} ListingStats;
+
+/**
+ * @brief Count a listed instruction
+ * 
+ * @param stats ListingStats* or NULL
+ * @param undefined int 1 if it has no known type
+ */
+static inline void countListed(ListingStats *stats, int undefined)
+{
+    if (stats) {
+        ++stats->instructions;
+        stats->undefined += undefined;
+    }
+}
+
+/**
+ * @brief Disassemble a whole text segment
+ * 
+ * @param out OutBuffer* where to write the listing
+ * @param text char*
+ * @param textLen int
+ * @param stats ListingStats* counted, or NULL
+ * @return int 0 on success, 1 on error
+ */
+int disassembleText(OutBuffer *out, char *text, int textLen, ListingStats *stats);
 
 /**
  * @brief 
@@ -163,4 +196,4 @@ int printInstruction(unsigned int pos, Instruction* instr);
  */
 int readText(FILE *file, Header *hdr);
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,65 @@
+#ifndef HEXFMT_H
+#define HEXFMT_H
+
+#include <stddef.h>
+
+/*
+ * --- HEX FORMATTING ---
+ *
+ * Bytes to lowercase ASCII hex, two characters per byte, no terminator.
+ * Long runs go through an SSE2 or AVX2 kernel picked once at run time
+ * from the CPU features, short ones and other targets through a
+ * 256-entry table of digit pairs.
+ */
+
+extern const char hexPairs[256][2];
+
+/**
+ * @brief 0x12 0x34 -> "1234", dst must hold 2 * len chars
+ *
+ * @param dst char*
+ * @param src const unsigned char*
+ * @param len size_t
+ */
+void hexEncode(char *dst, const unsigned char *src, size_t len);
+
+/**
+ * @brief 0x12 0x34 -> "3412", dst must hold 2 * len chars
+ *
+ * @param dst char*
+ * @param src const unsigned char*
+ * @param len size_t
+ */
+void hexEncodeRev(char *dst, const unsigned char *src, size_t len);
+
+/**
+ * @brief Write a 16 bit value as 4 hex digits
+ *
+ * @param dst char*
+ * @param value unsigned int
+ */
+static inline void hexEncodeWord(char *dst, unsigned int value)
+{
+    dst[0] = hexPairs[(value >> 8) & 0xff][0];
+    dst[1] = hexPairs[(value >> 8) & 0xff][1];
+    dst[2] = hexPairs[value & 0xff][0];
+    dst[3] = hexPairs[value & 0xff][1];
+}
+
+/**
+ * @brief Write a value in hex without leading zeros, "0" for 0
+ *
+ * @param dst char* at least 8 chars
+ * @param value unsigned int
+ * @return int the number of digits written
+ */
+int hexEncodeTrimmed(char *dst, unsigned int value);
+
+/**
+ * @brief Name of the kernel in use ("avx2", "sse2" or "scalar")
+ *
+ * @return const char*
+ */
+const char *hexKernelName(void);
+
+#endif
@@ -0,0 +1,108 @@
+#include "image.h"
+#include "header.h"
+#include "profile.h"
+#include "symbols.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static int clampSegment(size_t mapLen, size_t offset, int len)
+{
+    if (len < 0 || offset >= mapLen)
+        return 0;
+    return offset + len > mapLen ? mapLen - offset : len;
+}
+
+static int locateSegments(Image *img)
+{
+    size_t offset = img->hdr.hdrlen;
+    img->text = img->map + offset;
+    img->textLen = clampSegment(img->mapLen, offset, img->hdr.textlen);
+    offset += img->textLen;
+    img->data = img->map + offset;
+    img->dataLen = clampSegment(img->mapLen, offset, img->hdr.datalen);
+    offset += img->dataLen;
+    img->dataBase = (img->hdr.flags & A_SEP) ? 0 : img->textLen;
+
+    int symsLen = clampSegment(img->mapLen, offset, img->hdr.symslen);
+    return readSymbols(img->map + offset, symsLen, &img->syms);
+}
+
+int openImage(const char *path, Image *img)
+{
+    PROFILE_BEGIN(PROF_LOAD);
+    memset(img, 0, sizeof(Image));
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+
+    struct stat st;
+    if (readHeader(file, &img->hdr) != 0 || fstat(fileno(file), &st) != 0) {
+        fclose(file);
+        return 1;
+    }
+
+    img->mapLen = st.st_size;
+    img->map = mmap(NULL, img->mapLen, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+    fclose(file);
+    if (img->map == MAP_FAILED) {
+        printf("cannot map %s\n", path);
+        img->map = NULL;
+        return 1;
+    }
+    img->mapped = 1;
+
+    if (locateSegments(img) != 0) {
+        closeImage(img);
+        return 1;
+    }
+
+    PROFILE_END(PROF_LOAD);
+    PROFILE_COUNT(PROF_BYTES, img->textLen);
+    return 0;
+}
+
+int loadImage(char *bytes, size_t len, Image *img)
+{
+    memset(img, 0, sizeof(Image));
+
+    FILE *file = fmemopen(bytes, len, "rb");
+    if (file == NULL)
+        return 1;
+    int status = readHeader(file, &img->hdr);
+    fclose(file);
+    if (status != 0)
+        return 1;
+
+    img->map = bytes;
+    img->mapLen = len;
+    if (locateSegments(img) != 0) {
+        closeImage(img);
+        return 1;
+    }
+
+    PROFILE_COUNT(PROF_BYTES, img->textLen);
+    return 0;
+}
+
+void closeImage(Image *img)
+{
+    if (img->map && img->mapped)
+        munmap(img->map, img->mapLen);
+    freeSymbols(&img->syms);
+    memset(img, 0, sizeof(Image));
+}
+
+uint64_t imageHash(const Image *img)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < img->mapLen; ++i) {
+        h ^= (unsigned char)img->map[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
@@ -0,0 +1,73 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include "header.h"
+#include "symbols.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define A_SEP 0x20 // separate I & D, the data segment starts at 0
+
+/**
+ * @brief An a.out file mapped in memory
+ * @param hdr Header
+ * @param map char* the whole file, read only
+ * @param mapLen size_t
+ * @param mapped int 1 if map is a mapping of the file, 0 if borrowed
+ * @param text char* the text segment, in map
+ * @param textLen int
+ * @param data char* the data segment, in map
+ * @param dataLen int
+ * @param dataBase unsigned int address of the data segment
+ * @param syms SymbolTable
+ */
+typedef struct ImageStruct {
+    Header hdr;
+    char *map;
+    size_t mapLen;
+    int mapped;
+    char *text;
+    int textLen;
+    char *data;
+    int dataLen;
+    unsigned int dataBase;
+    SymbolTable syms;
+} Image;
+
+/**
+ * @brief Map an a.out file and locate its segments and symbols
+ *
+ * @param path const char*
+ * @param img Image*
+ * @return int 0 on success, 1 on error (message printed)
+ */
+int openImage(const char *path, Image *img);
+
+/**
+ * @brief Locate the segments and symbols of an a.out already in memory,
+ * the bytes are borrowed and must outlive the image
+ *
+ * @param bytes char*
+ * @param len size_t
+ * @param img Image*
+ * @return int 0 on success, 1 on error
+ */
+int loadImage(char *bytes, size_t len, Image *img);
+
+/**
+ * @brief FNV-1a hash of the whole file, for the files kept next to an
+ * executable to tell it changed even within the same second
+ *
+ * @param img const Image*
+ * @return uint64_t
+ */
+uint64_t imageHash(const Image *img);
+
+/**
+ * @brief Unmap an image
+ *
+ * @param img Image*
+ */
+void closeImage(Image *img);
+
+#endif
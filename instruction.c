@@ -1,4 +1,5 @@
 #include "instruction.h"
+#include "hexfmt.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -6,7 +7,7 @@
 char *getSegPrintStr(int s)
 {
     char *res = malloc(3);
-    switch (s) {
+    switch (s & 0b11) {
     case 0b00:
         strcpy(res, "es");
         break;
@@ -55,45 +56,48 @@ char *getRegPrintStr(int r, int w)
     return res;
 }
 
-char *getRegMemPrintStr(int m, int R)
+#define MODRM_MOD(b) ((b) >> 6)
+#define MODRM_EA(b) (MODRM_MOD(b) == 0b11 ? EA_REGISTER : ((b) & 0xc7) == 0x06 ? EA_DIRECT : (b) & 0x7)
+#define MODRM_DISP_LEN(b) (MODRM_MOD(b) == 0b01 ? 1 : (MODRM_MOD(b) == 0b10 || MODRM_EA(b) == EA_DIRECT) ? 2 : 0)
+#define MODRM_BASE(b) (MODRM_EA(b) == 0b000 || MODRM_EA(b) == 0b001 || MODRM_EA(b) == 0b111 ? REG_BX : \
+                       MODRM_EA(b) == 0b010 || MODRM_EA(b) == 0b011 || MODRM_EA(b) == 0b110 ? REG_BP : REG_NONE)
+#define MODRM_INDEX(b) (MODRM_EA(b) == 0b000 || MODRM_EA(b) == 0b010 || MODRM_EA(b) == 0b100 ? REG_SI : \
+                        MODRM_EA(b) == 0b001 || MODRM_EA(b) == 0b011 || MODRM_EA(b) == 0b101 ? REG_DI : REG_NONE)
+#define MODRM(b) {MODRM_MOD(b), ((b) >> 3) & 0x7, (b) & 0x7, MODRM_DISP_LEN(b), MODRM_BASE(b), MODRM_INDEX(b), MODRM_EA(b)}
+#define MODRM4(b) MODRM(b), MODRM((b) + 1), MODRM((b) + 2), MODRM((b) + 3)
+#define MODRM16(b) MODRM4(b), MODRM4((b) + 4), MODRM4((b) + 8), MODRM4((b) + 12)
+#define MODRM64(b) MODRM16(b), MODRM16((b) + 16), MODRM16((b) + 32), MODRM16((b) + 48)
+
+const ModRM modRMTable[256] = {MODRM64(0), MODRM64(64), MODRM64(128), MODRM64(192)};
+
+const char *const eaPrefixes[NUM_OF_EA] = {
+    "[bx+si", "[bx+di", "[bp+si", "[bp+di", "[si", "[di", "[bp", "[bx", "[", ""};
+
+const unsigned char eaPrefixLengths[NUM_OF_EA] = {6, 6, 6, 6, 3, 3, 3, 3, 1, 0};
+
+int formatEA(char *dst, const char *bytes)
 {
-    if (m == 0b11)
-        return getRegPrintStr(R, 1);
+    const ModRM *modRM = modRMTable + (unsigned char)bytes[0];
+    if (modRM->ea == EA_REGISTER)
+        return 0;
 
-    char *res = malloc(13);
+    int n = eaPrefixLengths[modRM->ea];
+    memcpy(dst, eaPrefixes[modRM->ea], n);
 
-    if (R == 0b110 && m == 0b00) {
-        strcpy(res, "[+disp]");
-    } else {
-        switch (R) {
-        case 0b000:
-            strcpy(res, "[bx+si+disp]");
-            break;
-        case 0b001:
-            strcpy(res, "[bx+di+disp]");
-            break;
-        case 0b010:
-            strcpy(res, "[bp+si+disp]");
-            break;
-        case 0b011:
-            strcpy(res, "[bp+di+disp]");
-            break;
-        case 0b100:
-            strcpy(res, "[si+disp]");
-            break;
-        case 0b101:
-            strcpy(res, "[di+disp]");
-            break;
-        case 0b110:
-            strcpy(res, "[bp+disp]");
-            break;
-        case 0b111:
-            strcpy(res, "[bx+disp]");
-            break;
-        }
+    if (modRM->ea == EA_DIRECT) { // EA = disph, displ
+        hexEncodeWord(dst + n, (bytes[1] & 0xff) | (bytes[2] & 0xff) << 8);
+        n += 4;
+    } else if (modRM->dispLen == 1) { // disp = displ sign extended to word
+        int disp = (signed char)bytes[1];
+        dst[n++] = disp < 0 ? '-' : '+';
+        n += hexEncodeTrimmed(dst + n, disp < 0 ? -disp : disp);
+    } else if (modRM->dispLen == 2) { // disp = disph, displ
+        dst[n++] = '+';
+        n += hexEncodeTrimmed(dst + n, (bytes[1] & 0xff) | (bytes[2] & 0xff) << 8);
     }
 
-    return res;
+    dst[n++] = ']';
+    return n;
 }
 
 const InstructionType instructionTypes[NUM_OF_INSTRUCT_TYPES] = {
@@ -229,4 +233,4 @@ const InstructionType instructionTypes[NUM_OF_INSTRUCT_TYPES] = {
     {"wait", "10011011"},                 // WAIT - Wait
     {"esc $R", "11011xxx(Rxxx)"},         // ESC - Escape (to External Device)
     {"lock", "11110000"},                 // LOCK - Bus Lock Prefix
-};
\ No newline at end of file
+};
\ No newline at end of file
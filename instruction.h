@@ -153,6 +153,41 @@ typedef struct InstructionStruct {
     short unsigned int partsLengths[MAX_INSTRUCT_LEN];
 } Instruction;
 
+#define REG_AX 0b000
+#define REG_CX 0b001
+#define REG_DX 0b010
+#define REG_BX 0b011
+#define REG_SP 0b100
+#define REG_BP 0b101
+#define REG_SI 0b110
+#define REG_DI 0b111
+#define REG_NONE -1
+
+#define EA_DIRECT 8    // mod = 00, r/m = 110 : [disph displ]
+#define EA_REGISTER 9  // mod = 11
+#define NUM_OF_EA 10
+#define EA_STR_LEN 16
+
+/**
+ * @brief A ModRM byte, decoded once for all of them in modRMTable
+ * @param mod unsigned char
+ * @param reg unsigned char
+ * @param rm unsigned char
+ * @param dispLen unsigned char length of the displacement, 0, 1 or 2
+ * @param base signed char REG_BX, REG_BP or REG_NONE
+ * @param index signed char REG_SI, REG_DI or REG_NONE
+ * @param ea unsigned char r/m, EA_DIRECT or EA_REGISTER, index in eaPrefixes
+ */
+typedef struct ModRMStruct {
+    unsigned char mod;
+    unsigned char reg;
+    unsigned char rm;
+    unsigned char dispLen;
+    signed char base;
+    signed char index;
+    unsigned char ea;
+} ModRM;
+
 /**
  * @brief Get the name of the segment register
  *
@@ -171,15 +206,19 @@ char *getSegPrintStr(int s);
 char *getRegPrintStr(int r, int w);
 
 /**
- * @brief Get the name of the register or memory position
+ * @brief Write the memory operand of a ModRM byte and its displacement,
+ * "[bx+si+2]", "[bp-4]", "[0002]"
  *
- * @param m int
- * @param R int
- * @return char*
+ * @param dst char* at least EA_STR_LEN chars, not terminated
+ * @param bytes const char* the ModRM byte then the displacement
+ * @return int the number of chars written, 0 if mod = 11 (register)
  */
-char *getRegMemPrintStr(int m, int R);
+int formatEA(char *dst, const char *bytes);
 
 extern const InstructionType instructionTypes[];
+extern const ModRM modRMTable[256];
+extern const char *const eaPrefixes[NUM_OF_EA];
+extern const unsigned char eaPrefixLengths[NUM_OF_EA];
 extern const char printFormatFields[];
 
-#endif
\ No newline at end of file
+#endif
\ No newline at end of file
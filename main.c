@@ -1,36 +1,388 @@
+#include "assembler.h"
+#include "cycles.h"
+#include "datadump.h"
+#include "diff.h"
 #include "disasembler.h"
 #include "header.h"
+#include "image.h"
+#include "output.h"
+#include "pipeline.h"
+#include "profile.h"
+#include "records.h"
+#include "render.h"
+#include "runs.h"
+#include "server.h"
+#include "shard.h"
+#include "signature.h"
+#include "slice.h"
+#include "syntax.h"
+#include "xref.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+/**
+ * @brief Disassemble through decoded records, reusing the records of a
+ * previous run of the same binary when given
+ *
+ * @param out OutBuffer*
+ * @param img Image*
+ * @param oldPath const char* previous record file or NULL
+ * @param newPath const char* where to save the records or NULL
+ * @return int 0 on success, 1 on error
+ */
+static int disassembleRecords(OutBuffer *out, Image *img, const char *oldPath, const char *newPath)
+{
+    DecodedText dec;
+    if (initDecodedText(&dec, img->textLen / 3) != 0)
+        return 1;
+
+    int status = 0;
+    if (oldPath) {
+        DecodedText old;
+        char *oldText;
+        int oldLen;
+        if (readRecords(oldPath, &old, &oldText, &oldLen) != 0) {
+            freeDecodedText(&dec);
+            return 1;
+        }
+        int decoded = redecodeText(&old, oldText, oldLen, img->text, img->textLen, &dec);
+        if (decoded < 0)
+            status = 1;
+        else
+            fprintf(stderr, "decoded %d of %u instructions\n", decoded, dec.count);
+        freeDecodedText(&old);
+        free(oldText);
+    } else {
+        status = decodeText(img->text, img->textLen, &dec);
+    }
+
+    // the records before a failure are listed, as disassembleText does
+    int listed = formatRecords(out, &dec, img->text);
+    if (status != 0) {
+        unsigned int end = dec.count ? dec.offsets[dec.count - 1] + dec.lengths[dec.count - 1] : 0;
+        if (end < (unsigned int)img->textLen && readInstruction(img->text, img->textLen, end).length == 0)
+            outStr(out, "zero length instruction\n");
+        outFlush(out);
+    }
+    status |= listed;
+    if (status == 0 && newPath)
+        status = writeRecords(newPath, &dec, img->text, img->textLen);
+
+    freeDecodedText(&dec);
+    return status;
+}
+
+/**
+ * @brief List a slice of the text, --symbol NAME or --start / --end
+ *
+ * @param out OutBuffer*
+ * @param img Image*
+ * @param path const char* of the executable, for its index
+ * @param symbol const char* or NULL
+ * @param start long, -1 if not given
+ * @param end long, -1 if not given
+ * @return int 0 on success, 1 on error
+ */
+static int disassembleRange(OutBuffer *out, Image *img, const char *path, const char *symbol, long start, long end)
+{
+    unsigned int from = 0, to = img->textLen;
+    if (symbol && symbolRange(img, symbol, &from, &to) != 0)
+        return 1;
+    if (start >= 0)
+        from = start;
+    if (end >= 0)
+        to = end;
+
+    BoundaryIndex idx;
+    if (loadIndex(path, img, &idx) != 0)
+        return 1;
+    int status = disassembleSlice(out, img, &idx, from, to);
+    freeIndex(&idx);
+    return status;
+}
+
+/**
+ * @brief dis seek FILE ADDR : print the offset of the line of ADDR in the
+ * listing of FILE
+ *
+ * @param path const char*
+ * @param addr unsigned int
+ * @return int 0 on success, 1 on error
+ */
+static int seekListing(const char *path, unsigned int addr)
+{
+    Image img;
+    BoundaryIndex idx;
+    if (openImage(path, &img) != 0)
+        return 1;
+    if (loadIndex(path, &img, &idx) != 0) {
+        closeImage(&img);
+        return 1;
+    }
+    printf("%ld\n", listingOffset(&img, &idx, addr));
+    freeIndex(&idx);
+    closeImage(&img);
+    return 0;
+}
+
+/**
+ * @brief dis asm [ADDR] : assemble as86 lines from stdin and list them
+ *
+ * @param pos unsigned int of the first line
+ * @return int 0 on success, 1 on error
+ */
+static int assembleInput(unsigned int pos)
+{
+    OutBuffer out;
+    if (initOutBuffer(&out, stdout, OUT_BUFFER_SIZE) != 0)
+        return 1;
+    // listed in the syntax it is written in
+    setSyntax(SYNTAX_AS86);
+    int status = assembleStream(stdin, &out, pos);
+    freeOutBuffer(&out);
+    return status;
+}
+
+/**
+ * @brief dis shard QUEUE [--merge] [--format F] [--data] [--pipeline]
+ * [--workers N] [--lease SECONDS]
+ *
+ * @param argc int
+ * @param argv char** from QUEUE on
+ * @return int 0 on success, 1 on error
+ */
+static int shardQueue(int argc, char **argv)
+{
+    ShardOptions opts = {FORMAT_TEXT, 0, 0, 1, SHARD_LEASE};
+    int merge = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--merge") == 0) {
+            merge = 1;
+        } else if (strcmp(argv[i], "--data") == 0) {
+            opts.options |= RENDER_DATA;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            opts.pipelined = 1;
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            opts.format = parseRenderFormat(argv[++i]);
+            if (opts.format < 0) {
+                printf("unknown format %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            opts.workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lease") == 0 && i + 1 < argc) {
+            opts.lease = atoi(argv[++i]);
+        } else {
+            printf("unexpected argument %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (merge)
+        return mergeShardSummary(argv[0], stdout);
+    return runShard(argv[0], &opts);
+}
+
 int main(int argc, char **argv)
 {
-    FILE *file;
     int status;
+    char *path = NULL, *recordsPath = NULL, *oldRecordsPath = NULL;
+    char *servePath = NULL, *clientPath = NULL, *symbol = NULL, *sigsPath = NULL;
+    long start = -1, end = -1;
+    int profile = 0, data = 0, pipelined = 0, cycles = 0, runs = 0, roundtrip = 0, threads = 0;
+    int format = FORMAT_TEXT, syntax = SYNTAX_MMVM;
+
+    if (argc > 1 && strcmp(argv[1], "diff") == 0) {
+        if (argc != 4) {
+            printf("usage: dis diff OLD NEW\n");
+            exit(2);
+        }
+        return diffImages(argv[2], argv[3], stdout);
+    }
+    if (argc > 1 && strcmp(argv[1], "xref") == 0) {
+        if (argc != 4) {
+            printf("usage: dis xref FILE ADDR|SYMBOL\n");
+            exit(1);
+        }
+        return queryXrefs(argv[2], argv[3], stdout);
+    }
+    if (argc > 1 && strcmp(argv[1], "seek") == 0) {
+        if (argc != 4) {
+            printf("usage: dis seek FILE ADDR\n");
+            exit(1);
+        }
+        return seekListing(argv[2], strtoul(argv[3], NULL, 16));
+    }
+    if (argc > 1 && strcmp(argv[1], "shard") == 0) {
+        if (argc < 3) {
+            printf("usage: dis shard QUEUE [--merge] [--format F] [--data] [--pipeline] [--workers N] [--lease S]\n");
+            exit(1);
+        }
+        return shardQueue(argc - 2, argv + 2);
+    }
+    if (argc > 1 && strcmp(argv[1], "sig") == 0) {
+        if (argc < 5 || strcmp(argv[2], "build") != 0) {
+            printf("usage: dis sig build OUT FILE...\n");
+            exit(1);
+        }
+        return buildSignatureFile(argv[3], argv + 4, argc - 4);
+    }
+    if (argc > 1 && strcmp(argv[1], "asm") == 0) {
+        if (argc > 3) {
+            printf("usage: dis asm [ADDR] < FILE\n");
+            exit(1);
+        }
+        return assembleInput(argc == 3 ? strtoul(argv[2], NULL, 16) : 0);
+    }
+    if (argc > 1 && strcmp(argv[1], "patch") == 0) {
+        int force = argc > 2 && strcmp(argv[2], "--force") == 0;
+        if (argc != 5 + force) {
+            printf("usage: dis patch [--force] FILE ADDR INSTRUCTION\n");
+            exit(1);
+        }
+        return patchImage(argv[2 + force], strtoul(argv[3 + force], NULL, 16), argv[4 + force], force);
+    }
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--profile") == 0) {
+            profile = 1;
+        } else if (strcmp(argv[i], "--data") == 0) {
+            data = 1;
+        } else if (strcmp(argv[i], "--pipeline") == 0) {
+            pipelined = 1;
+        } else if (strcmp(argv[i], "--cycles") == 0) {
+            cycles = 1;
+        } else if (strcmp(argv[i], "--runs") == 0) {
+            runs = 1;
+        } else if (strcmp(argv[i], "--roundtrip") == 0) {
+            roundtrip = 1;
+        } else if (strcmp(argv[i], "--records") == 0 && i + 1 < argc) {
+            recordsPath = argv[++i];
+        } else if (strcmp(argv[i], "--incremental") == 0 && i + 1 < argc) {
+            oldRecordsPath = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            format = parseRenderFormat(argv[++i]);
+            if (format < 0) {
+                printf("unknown format %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--syntax") == 0 && i + 1 < argc) {
+            syntax = parseSyntax(argv[++i]);
+            if (syntax < 0) {
+                printf("unknown syntax %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--sigs") == 0 && i + 1 < argc) {
+            sigsPath = argv[++i];
+        } else if (strcmp(argv[i], "--start") == 0 && i + 1 < argc) {
+            start = strtoul(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--end") == 0 && i + 1 < argc) {
+            end = strtoul(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--symbol") == 0 && i + 1 < argc) {
+            symbol = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc) {
+            clientPath = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            printf("unexpected argument %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    // before any thread formats
+    setSyntax(syntax);
 
-    if (argc != 2) {
+    if (servePath)
+        return serve(servePath, threads);
+
+    if (path == NULL) {
         printf("no file path specified\n");
         exit(1);
     }
 
-    file = fopen(argv[1], "rb");
+    // the listing is the first of these that is set, an other one would be dropped
+    struct {
+        int set;
+        const char *name;
+    } modes[] = {{recordsPath != NULL || oldRecordsPath != NULL, "--records/--incremental"},
+                 {symbol != NULL || start >= 0 || end >= 0, "--start/--end/--symbol"},
+                 {cycles, "--cycles"}, {runs, "--runs"}, {roundtrip, "--roundtrip"},
+                 {sigsPath != NULL, "--sigs"}, {pipelined, "--pipeline"}};
+    const char *mode = NULL;
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i) {
+        if (!modes[i].set)
+            continue;
+        if (mode != NULL) {
+            printf("%s and %s are different listings, give only one\n", mode, modes[i].name);
+            exit(1);
+        }
+        mode = modes[i].name;
+    }
+
+    if (clientPath) {
+        // the server renders with renderImage, --pipeline lists the same
+        struct {
+            int set;
+            const char *name;
+        } local[] = {{profile, "--profile"}, {roundtrip, "--roundtrip"}, {recordsPath != NULL, "--records"},
+                     {oldRecordsPath != NULL, "--incremental"}, {symbol != NULL, "--symbol"},
+                     {start >= 0, "--start"}, {end >= 0, "--end"}, {sigsPath != NULL, "--sigs"},
+                     {syntax != SYNTAX_MMVM, "--syntax"}};
+        for (size_t i = 0; i < sizeof(local) / sizeof(local[0]); ++i) {
+            if (local[i].set) {
+                printf("%s is not sent to the server, only --data, --format, --cycles, --runs and --pipeline\n",
+                       local[i].name);
+                exit(1);
+            }
+        }
+        int options = (data ? RENDER_DATA : 0) | (cycles ? RENDER_CYCLES : runs ? RENDER_RUNS : 0);
+        return requestServer(clientPath, path, options, format, stdout) != 0;
+    }
 
-    Header *hdr = malloc(sizeof(Header));
-    status = readHeader(file, hdr);
-    // printHeader(hdr);
+    if (profile)
+        profileStart();
 
-    status = readText(file, hdr);
-    // char a = 0b11111111;
-    // for (int i = 0; i < NUM_OF_INSTRUCT_TYPES; ++i) {
-    //     Instruction instr = {
-    //         instructionTypes + i,
-    //         &a,
-    //         1};
-    //     int res = getField(&instr, 'w');
-    //     printf("res = %d\t%s\n", res, instr.type->printFormat);
-    // }
+    Image img;
+    if (openImage(path, &img) != 0)
+        exit(1);
+    // printHeader(&img.hdr);
 
-    free(hdr);
-    return 0;
+    OutBuffer out;
+    if (initOutBuffer(&out, stdout, OUT_BUFFER_SIZE) != 0)
+        exit(1);
+
+    if (format != FORMAT_TEXT)
+        status = renderImage(&out, &img, 0, format, NULL);
+    else if (recordsPath || oldRecordsPath)
+        status = disassembleRecords(&out, &img, oldRecordsPath, recordsPath);
+    else if (symbol || start >= 0 || end >= 0)
+        status = disassembleRange(&out, &img, path, symbol, start, end);
+    else if (cycles)
+        status = listCycles(&out, &img, NULL);
+    else if (runs)
+        status = disassembleRuns(&out, img.text, img.textLen, NULL);
+    else if (roundtrip)
+        status = roundtripImage(stdout, &img);
+    else if (sigsPath)
+        status = disassembleSignatures(&out, &img, sigsPath);
+    else if (pipelined)
+        status = disassemblePipelined(stdout, img.text, img.textLen, NULL);
+    else
+        status = disassembleText(&out, img.text, img.textLen, NULL);
+    if (status == 0 && data && format == FORMAT_TEXT)
+        status = dumpData(&out, &img);
+
+    freeOutBuffer(&out);
+    closeImage(&img);
+
+    if (profile) {
+        fflush(stdout);
+        profileReport(stderr);
+    }
+    return status != 0;
 }
@@ -0,0 +1,123 @@
+#include "output.h"
+#include "hexfmt.h"
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_BYTES_WIDTH 13
+
+int initOutBuffer(OutBuffer *out, FILE *file, size_t cap)
+{
+    if (cap == 0)
+        cap = OUT_BUFFER_SIZE;
+    out->file = file;
+    out->len = 0;
+    out->cap = cap;
+    out->data = malloc(cap);
+    return out->data == NULL;
+}
+
+void freeOutBuffer(OutBuffer *out)
+{
+    outFlush(out);
+    free(out->data);
+    out->data = NULL;
+    out->len = 0;
+    out->cap = 0;
+}
+
+int outFlush(OutBuffer *out)
+{
+    if (out->file == NULL || out->len == 0)
+        return 0;
+
+    PROFILE_BEGIN(PROF_OUTPUT);
+    size_t written = fwrite(out->data, 1, out->len, out->file);
+    PROFILE_END(PROF_OUTPUT);
+    int status = written != out->len;
+    out->len = 0;
+    return status;
+}
+
+int outMaybeFlush(OutBuffer *out)
+{
+    if (out->file != NULL && out->len + 256 >= out->cap)
+        return outFlush(out);
+    return 0;
+}
+
+char *outReserve(OutBuffer *out, size_t n)
+{
+    if (out->len + n > out->cap) {
+        size_t cap = out->cap * 2;
+        while (out->len + n > cap)
+            cap *= 2;
+        char *data = realloc(out->data, cap);
+        if (data == NULL) {
+            printf("out of memory\n");
+            exit(1);
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+    return out->data + out->len;
+}
+
+void outWrite(OutBuffer *out, const char *str, size_t n)
+{
+    memcpy(outReserve(out, n), str, n);
+    out->len += n;
+}
+
+void outStr(OutBuffer *out, const char *str)
+{
+    outWrite(out, str, strlen(str));
+}
+
+void outChar(OutBuffer *out, char c)
+{
+    *outReserve(out, 1) = c;
+    ++out->len;
+}
+
+void outHex(OutBuffer *out, const char *bytes, size_t len)
+{
+    hexEncode(outReserve(out, 2 * len), (const unsigned char *)bytes, len);
+    out->len += 2 * len;
+}
+
+void outDecimal(OutBuffer *out, unsigned long value)
+{
+    char digits[20];
+    int n = 0;
+    do {
+        digits[sizeof(digits) - ++n] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    memcpy(outReserve(out, n), digits + sizeof(digits) - n, n);
+    out->len += n;
+}
+
+void outAddr(OutBuffer *out, unsigned int addr)
+{
+    if (addr > 0xffff) {
+        char tmp[16];
+        outWrite(out, tmp, snprintf(tmp, sizeof(tmp), "%04x", addr));
+        return;
+    }
+    hexEncodeWord(outReserve(out, 4), addr);
+    out->len += 4;
+}
+
+void outLinePrefix(OutBuffer *out, unsigned int addr, const char *bytes, size_t len)
+{
+    outAddr(out, addr);
+    size_t width = 2 * len < LINE_BYTES_WIDTH ? LINE_BYTES_WIDTH : 2 * len;
+    char *dst = outReserve(out, width + 3);
+    dst[0] = ':';
+    dst[1] = ' ';
+    hexEncode(dst + 2, (const unsigned char *)bytes, len);
+    memset(dst + 2 + 2 * len, ' ', width - 2 * len + 1);
+    out->len += width + 3;
+}
@@ -0,0 +1,106 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+#define OUT_BUFFER_SIZE 65536
+
+/**
+ * @brief A growable output buffer, written to a file in big blocks
+ * @param file FILE* where outFlush writes, NULL to keep the text in memory
+ * @param data char*
+ * @param len size_t bytes used
+ * @param cap size_t bytes allocated
+ */
+typedef struct OutBufferStruct {
+    FILE *file;
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuffer;
+
+/**
+ * @brief Initialise an output buffer
+ *
+ * @param out OutBuffer*
+ * @param file FILE* or NULL
+ * @param cap size_t initial size
+ * @return int 0 on success, 1 on allocation failure
+ */
+int initOutBuffer(OutBuffer *out, FILE *file, size_t cap);
+
+/**
+ * @brief Flush then free an output buffer
+ *
+ * @param out OutBuffer*
+ */
+void freeOutBuffer(OutBuffer *out);
+
+/**
+ * @brief Write the buffered text to the file and empty the buffer
+ *
+ * @param out OutBuffer*
+ * @return int 0 on success, 1 on write error
+ */
+int outFlush(OutBuffer *out);
+
+/**
+ * @brief Flush if the buffer is almost full, to call between lines
+ *
+ * @param out OutBuffer*
+ * @return int 0 on success, 1 on write error
+ */
+int outMaybeFlush(OutBuffer *out);
+
+/**
+ * @brief Make room for n more bytes, never flushes
+ *
+ * @param out OutBuffer*
+ * @param n size_t
+ * @return char* where to write the n bytes, the caller advances out->len
+ */
+char *outReserve(OutBuffer *out, size_t n);
+
+void outWrite(OutBuffer *out, const char *str, size_t n);
+
+void outStr(OutBuffer *out, const char *str);
+
+void outChar(OutBuffer *out, char c);
+
+/**
+ * @brief Write bytes as hex, "1234" for 0x12 0x34
+ *
+ * @param out OutBuffer*
+ * @param bytes const char*
+ * @param len size_t
+ */
+void outHex(OutBuffer *out, const char *bytes, size_t len);
+
+/**
+ * @brief Write a number in decimal, like "%lu"
+ *
+ * @param out OutBuffer*
+ * @param value unsigned long
+ */
+void outDecimal(OutBuffer *out, unsigned long value);
+
+/**
+ * @brief Write an address as at least 4 hex digits, like "%04x"
+ *
+ * @param out OutBuffer*
+ * @param addr unsigned int
+ */
+void outAddr(OutBuffer *out, unsigned int addr);
+
+/**
+ * @brief Write the start of a listing line, like "%04x: %-13s "
+ *
+ * @param out OutBuffer*
+ * @param addr unsigned int
+ * @param bytes const char* raw bytes of the line
+ * @param len size_t
+ */
+void outLinePrefix(OutBuffer *out, unsigned int addr, const char *bytes, size_t len);
+
+#endif
@@ -0,0 +1,144 @@
+#include "pipeline.h"
+#include "disasembler.h"
+#include "output.h"
+#include "profile.h"
+#include "records.h"
+#include "ring.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * @brief A record in flight, with its position aside : a Record offset is
+ * 16 bits and the text of a single binary may be longer
+ * @param pos unsigned int
+ * @param rec Record decoded at offset 0 of its instruction
+ */
+typedef struct PipelineRecordStruct {
+    unsigned int pos;
+    Record rec;
+} PipelineRecord;
+
+typedef struct PipelineStruct {
+    char *text;
+    FILE *file;
+    SpscRing records;    // decoder -> formatter, length 0 ends
+    SpscRing blocks;     // formatter -> writer, NULL data ends
+    SpscRing freeBlocks; // writer -> formatter
+    int writeStatus;
+} Pipeline;
+
+static void *formatterThread(void *arg)
+{
+    Pipeline *pipe = arg;
+    PipelineRecord item;
+    OutBuffer block;
+    initOutBuffer(&block, NULL, PIPELINE_BLOCK_SIZE);
+
+    for (;;) {
+        ringPopWait(&pipe->records, &item);
+        if (item.rec.length == 0)
+            break;
+
+        Instruction instr = recordToInstruction(&item.rec, pipe->text + item.pos);
+        formatInstruction(&block, item.pos, &instr);
+
+        if (block.len + 256 >= block.cap) {
+            ringPushWait(&pipe->blocks, &block);
+            if (ringPop(&pipe->freeBlocks, &block) != 0)
+                initOutBuffer(&block, NULL, PIPELINE_BLOCK_SIZE);
+        }
+    }
+
+    if (block.len > 0)
+        ringPushWait(&pipe->blocks, &block);
+    else
+        freeOutBuffer(&block);
+    block.data = NULL;
+    ringPushWait(&pipe->blocks, &block);
+    return NULL;
+}
+
+static void *writerThread(void *arg)
+{
+    Pipeline *pipe = arg;
+    OutBuffer block;
+
+    for (;;) {
+        ringPopWait(&pipe->blocks, &block);
+        if (block.data == NULL)
+            break;
+
+        block.file = pipe->file;
+        if (outFlush(&block) != 0)
+            pipe->writeStatus = 1;
+        block.file = NULL;
+        if (ringPush(&pipe->freeBlocks, &block) != 0)
+            freeOutBuffer(&block);
+    }
+    return NULL;
+}
+
+int disassemblePipelined(FILE *file, char *text, int textLen, ListingStats *stats)
+{
+    Pipeline pipe = {text, file};
+    if (initRing(&pipe.records, PIPELINE_RECORDS, sizeof(PipelineRecord)) != 0 ||
+        initRing(&pipe.blocks, PIPELINE_BLOCKS, sizeof(OutBuffer)) != 0 ||
+        initRing(&pipe.freeBlocks, PIPELINE_BLOCKS, sizeof(OutBuffer)) != 0)
+        return 1;
+
+    PipelineRecord end = {0, {0, 0, RECORD_UNDEFINED, 0}};
+    pthread_t formatter, writer;
+    if (pthread_create(&formatter, NULL, formatterThread, &pipe) != 0) {
+        freeRing(&pipe.records);
+        freeRing(&pipe.blocks);
+        freeRing(&pipe.freeBlocks);
+        printf("cannot start the pipeline threads\n");
+        return 1;
+    }
+    if (pthread_create(&writer, NULL, writerThread, &pipe) != 0) {
+        // the formatter ends on the end record, its blocks are dropped
+        ringPushWait(&pipe.records, &end);
+        pthread_join(formatter, NULL);
+        OutBuffer block;
+        while (ringPop(&pipe.blocks, &block) == 0)
+            freeOutBuffer(&block);
+        freeRing(&pipe.records);
+        freeRing(&pipe.blocks);
+        freeRing(&pipe.freeBlocks);
+        printf("cannot start the pipeline threads\n");
+        return 1;
+    }
+
+    int status = 0;
+    unsigned int pos = 0;
+    while (pos < textLen) {
+        PROFILE_BEGIN(PROF_DECODE);
+        Instruction res = readInstruction(text, textLen, pos);
+        PROFILE_END(PROF_DECODE);
+        PROFILE_COUNT(PROF_INSTRUCTIONS, 1);
+        if (res.length == 0) {
+            status = 1;
+            break;
+        }
+        countListed(stats, res.type == NULL);
+        PipelineRecord item = {pos, makeRecord(0, &res)};
+        ringPushWait(&pipe.records, &item);
+        pos += res.length;
+    }
+
+    ringPushWait(&pipe.records, &end);
+    pthread_join(formatter, NULL);
+    pthread_join(writer, NULL);
+
+    OutBuffer block;
+    while (ringPop(&pipe.freeBlocks, &block) == 0)
+        freeOutBuffer(&block);
+    freeRing(&pipe.records);
+    freeRing(&pipe.blocks);
+    freeRing(&pipe.freeBlocks);
+
+    if (status != 0)
+        fputs("zero length instruction\n", file);
+    return status | pipe.writeStatus;
+}
@@ -0,0 +1,33 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "disasembler.h"
+#include <stdio.h>
+
+/*
+ * --- PIPELINE ---
+ *
+ * Disassembly on three threads :
+ *   decoder   (caller) readInstruction -> records ring
+ *   formatter          records ring -> formatInstruction -> blocks ring
+ *   writer             blocks ring -> fwrite, emptied blocks go back
+ * Every ring has one producer and one consumer (SpscRing).
+ */
+
+#define PIPELINE_RECORDS 4096 // records in flight
+#define PIPELINE_BLOCKS 8     // output blocks in flight
+#define PIPELINE_BLOCK_SIZE 65536
+
+/**
+ * @brief Disassemble a text segment with overlapping decode, format and
+ * write stages
+ *
+ * @param file FILE* where to write the listing
+ * @param text char*
+ * @param textLen int
+ * @param stats ListingStats* counted by the decoder, or NULL
+ * @return int 0 on success, 1 on error
+ */
+int disassemblePipelined(FILE *file, char *text, int textLen, ListingStats *stats);
+
+#endif
@@ -0,0 +1,78 @@
+#include "profile.h"
+#include "hexfmt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifdef DIS_PROFILE
+
+unsigned long long profileTotals[NUM_OF_PROF_PHASES] = {0};
+unsigned long long profileCounters[NUM_OF_PROF_COUNTERS] = {0};
+
+static const char *phaseNames[NUM_OF_PROF_PHASES] = {
+    "load", "decode", "  length", "format", "output"};
+
+static unsigned long long startTicks;
+static struct timespec startTime;
+
+void *__real_malloc(size_t size);
+
+// linked in place of malloc with -Wl,--wrap=malloc
+void *__wrap_malloc(size_t size)
+{
+    profileCount(PROF_ALLOCS, 1);
+    profileCount(PROF_ALLOC_BYTES, size);
+    return __real_malloc(size);
+}
+
+int profileStart(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    startTicks = profileTicks();
+    return 0;
+}
+
+int profileReport(FILE *file)
+{
+    struct timespec endTime;
+    unsigned long long endTicks = profileTicks();
+    clock_gettime(CLOCK_MONOTONIC, &endTime);
+
+    double elapsedNs = (endTime.tv_sec - startTime.tv_sec) * 1e9 +
+                       (endTime.tv_nsec - startTime.tv_nsec);
+    double nsPerTick = 1.0;
+    if (endTicks > startTicks)
+        nsPerTick = elapsedNs / (double)(endTicks - startTicks);
+
+    unsigned long long instrs = profileCounters[PROF_INSTRUCTIONS];
+
+    fprintf(file, "%-10s %12s %12s\n", "phase", "total ms", "ns/instr");
+    for (int i = 0; i < NUM_OF_PROF_PHASES; ++i) {
+        double ns = profileTotals[i] * nsPerTick;
+        fprintf(file, "%-10s %12.3f %12.1f\n", phaseNames[i], ns / 1e6,
+                instrs ? ns / instrs : 0.0);
+    }
+    fprintf(file, "%-10s %12.3f\n", "elapsed", elapsedNs / 1e6);
+    fprintf(file, "instructions: %llu \tbytes: %llu\n", instrs,
+            profileCounters[PROF_BYTES]);
+    fprintf(file, "allocations: %llu (%llu B) \tper instr: %.2f\n",
+            profileCounters[PROF_ALLOCS], profileCounters[PROF_ALLOC_BYTES],
+            instrs ? (double)profileCounters[PROF_ALLOCS] / instrs : 0.0);
+    fprintf(file, "hex kernel: %s\n", hexKernelName());
+    return 0;
+}
+
+#else
+
+int profileStart(void)
+{
+    return 1;
+}
+
+int profileReport(FILE *file)
+{
+    fprintf(file, "profiling is not compiled in, rebuild with make PROFILE=1\n");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * --- PROFILING ---
+ *
+ * Phase timers and counters for the hot path, compiled in only when
+ * DIS_PROFILE is defined (make PROFILE=1). Otherwise every macro expands
+ * to nothing and the instrumented code is unchanged.
+ *
+ * A phase is timed between PROFILE_BEGIN and PROFILE_END in the same block,
+ * phases may nest (length calc is measured inside decode).
+ */
+
+/// @brief The timed phases
+typedef enum ProfilePhaseEnum {
+    PROF_LOAD,   // readHeader / readText I/O
+    PROF_DECODE, // readInstruction
+    PROF_LENGTH, // calcInstrLengthFrom (inside decode)
+    PROF_FORMAT, // printInstruction, without the output
+    PROF_OUTPUT, // writing the formatted text
+    NUM_OF_PROF_PHASES
+} ProfilePhase;
+
+/// @brief The event counters
+typedef enum ProfileCounterEnum {
+    PROF_INSTRUCTIONS,
+    PROF_BYTES,
+    PROF_ALLOCS,
+    PROF_ALLOC_BYTES,
+    NUM_OF_PROF_COUNTERS
+} ProfileCounter;
+
+#ifdef DIS_PROFILE
+
+#define PROFILE_BEGIN(phase) unsigned long long profStart##phase = profileTicks()
+#define PROFILE_END(phase) profileAddTicks(phase, profileTicks() - profStart##phase)
+#define PROFILE_COUNT(counter, n) profileCount(counter, n)
+
+extern unsigned long long profileTotals[NUM_OF_PROF_PHASES];
+extern unsigned long long profileCounters[NUM_OF_PROF_COUNTERS];
+
+/**
+ * @brief Read the cycle counter (rdtsc), or the monotonic clock in ns
+ * where there is none
+ *
+ * @return unsigned long long ticks
+ */
+static inline unsigned long long profileTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+// atomic, the pipeline stages run on their own threads
+static inline void profileAddTicks(ProfilePhase phase, unsigned long long ticks)
+{
+    __atomic_fetch_add(&profileTotals[phase], ticks, __ATOMIC_RELAXED);
+}
+
+static inline void profileCount(ProfileCounter counter, unsigned long long n)
+{
+    __atomic_fetch_add(&profileCounters[counter], n, __ATOMIC_RELAXED);
+}
+
+#else
+
+#define PROFILE_BEGIN(phase) ((void)0)
+#define PROFILE_END(phase) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+
+#endif
+
+/**
+ * @brief Start the calibration of the ticks against the wall clock
+ *
+ * @return int 0 on success, 1 if profiling is not compiled in
+ */
+int profileStart(void);
+
+/**
+ * @brief Print the per-phase summary (ns/instruction, allocations)
+ *
+ * @param file FILE* where to print
+ * @return int 0 on success, 1 if profiling is not compiled in
+ */
+int profileReport(FILE *file);
+
+#endif
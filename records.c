@@ -0,0 +1,434 @@
+#include "records.h"
+#include "disasembler.h"
+#include "profile.h"
+#include "syntax.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CHANGE_BLOCK_LEN 64
+
+int initDecodedText(DecodedText *dec, unsigned int capacity)
+{
+    if (capacity == 0)
+        capacity = 256;
+    dec->count = 0;
+    dec->capacity = capacity;
+    dec->offsets = malloc(sizeof(uint16_t) * capacity);
+    dec->lengths = malloc(sizeof(uint8_t) * capacity);
+    dec->typeIds = malloc(sizeof(uint8_t) * capacity);
+    dec->operands = malloc(sizeof(uint16_t) * capacity);
+    if (!dec->offsets || !dec->lengths || !dec->typeIds || !dec->operands) {
+        freeDecodedText(dec);
+        return 1;
+    }
+    return 0;
+}
+
+void freeDecodedText(DecodedText *dec)
+{
+    free(dec->offsets);
+    free(dec->lengths);
+    free(dec->typeIds);
+    free(dec->operands);
+    dec->offsets = NULL;
+    dec->lengths = NULL;
+    dec->typeIds = NULL;
+    dec->operands = NULL;
+    dec->count = 0;
+    dec->capacity = 0;
+}
+
+static int growDecodedText(DecodedText *dec)
+{
+    unsigned int capacity = dec->capacity * 2;
+    uint16_t *offsets = realloc(dec->offsets, sizeof(uint16_t) * capacity);
+    if (offsets)
+        dec->offsets = offsets;
+    uint8_t *lengths = realloc(dec->lengths, sizeof(uint8_t) * capacity);
+    if (lengths)
+        dec->lengths = lengths;
+    uint8_t *typeIds = realloc(dec->typeIds, sizeof(uint8_t) * capacity);
+    if (typeIds)
+        dec->typeIds = typeIds;
+    uint16_t *operands = realloc(dec->operands, sizeof(uint16_t) * capacity);
+    if (operands)
+        dec->operands = operands;
+    if (!offsets || !lengths || !typeIds || !operands)
+        return 1;
+    dec->capacity = capacity;
+    return 0;
+}
+
+/**
+ * @brief What packOperands and recordTarget need of a type, found once
+ */
+typedef struct RecordPlanStruct {
+    FieldMask r, s, w, W, d;
+    uint8_t opcodeLen;
+    uint8_t hasModRM;
+    uint8_t targetWidth; // bytes of the relative target ($P), 0 if none
+} RecordPlan;
+
+static RecordPlan recordPlans[NUM_OF_INSTRUCT_TYPES];
+static pthread_once_t recordPlansOnce = PTHREAD_ONCE_INIT;
+
+static void compileRecordPlans(void)
+{
+    for (int t = 0; t < NUM_OF_INSTRUCT_TYPES; ++t) {
+        const InstructionType *type = instructionTypes + t;
+        RecordPlan *plan = recordPlans + t;
+        plan->r = compileField(type, 'r');
+        plan->s = compileField(type, 's');
+        plan->w = compileField(type, 'w');
+        plan->W = compileField(type, 'W');
+        plan->d = compileField(type, 'd');
+        plan->opcodeLen = opcodeLength(type);
+        plan->hasModRM = strstr(type->codeFormat, "(R") != NULL;
+        const char *field = strstr(type->codeFormat, "(P");
+        plan->targetWidth = field == NULL ? 0 : field[2] == 'w' ? 2 : 1;
+    }
+}
+
+uint16_t packOperands(Instruction *instr)
+{
+    if (instr->type == NULL)
+        return 0;
+
+    pthread_once(&recordPlansOnce, compileRecordPlans);
+    const RecordPlan *plan = recordPlans + (instr->type - instructionTypes);
+    const unsigned char *data = (const unsigned char *)instr->data;
+    uint16_t res = 0;
+
+    if (plan->hasModRM) {
+        const ModRM *modRM = modRMTable + data[1];
+        res |= modRM->rm;
+        res |= modRM->reg << 3;
+        res |= modRM->mod << 6;
+        res |= 1 << 8;
+        res |= modRM->dispLen << 12;
+    } else if (plan->r.div) {
+        res |= (fieldValue(plan->r, data, plan->opcodeLen) & 0x7) << 3;
+    } else if (plan->s.div) {
+        res |= (fieldValue(plan->s, data, plan->opcodeLen) & 0x3) << 3;
+    }
+
+    if (plan->w.div)
+        res |= (fieldValue(plan->w, data, plan->opcodeLen) & 0x1) << 9;
+    if (plan->W.div) {
+        int W = fieldValue(plan->W, data, plan->opcodeLen);
+        res |= (W & 0x1) << 9;
+        res |= ((W >> 1) & 0x1) << 11;
+    }
+    if (plan->d.div)
+        res |= (fieldValue(plan->d, data, plan->opcodeLen) & 0x1) << 10;
+
+    return res;
+}
+
+Record makeRecord(unsigned int pos, Instruction *instr)
+{
+    Record rec;
+    rec.offset = pos;
+    rec.length = instr->length;
+    rec.typeId = instr->type ? instr->type - instructionTypes : RECORD_UNDEFINED;
+    rec.operands = packOperands(instr);
+    return rec;
+}
+
+Instruction recordToInstruction(const Record *rec, char *text)
+{
+    Instruction res = {NULL, text + rec->offset, rec->length, {0}};
+    if (rec->typeId == RECORD_UNDEFINED)
+        return res;
+
+    res.type = instructionTypes + rec->typeId;
+    calcInstrLengthFrom(&res, getTypeParts(res.type));
+    return res;
+}
+
+int appendRecord(DecodedText *dec, unsigned int pos, Instruction *instr)
+{
+    if (dec->count == dec->capacity && growDecodedText(dec) != 0)
+        return 1;
+
+    Record rec = makeRecord(pos, instr);
+    unsigned int i = dec->count++;
+    dec->offsets[i] = rec.offset;
+    dec->lengths[i] = rec.length;
+    dec->typeIds[i] = rec.typeId;
+    dec->operands[i] = rec.operands;
+    return 0;
+}
+
+int decodeText(char *text, int textLen, DecodedText *dec)
+{
+    if (textLen > 0x10000) { // offsets are 16 bits, as the segment
+        printf("text of %d bytes too long for records\n", textLen);
+        return 1;
+    }
+
+    unsigned int pos = 0;
+    while (pos < textLen) {
+        PROFILE_BEGIN(PROF_DECODE);
+        Instruction res = readInstruction(text, textLen, pos);
+        PROFILE_END(PROF_DECODE);
+        PROFILE_COUNT(PROF_INSTRUCTIONS, 1);
+        if (res.length == 0)
+            return 1;
+        if (appendRecord(dec, pos, &res) != 0)
+            return 1;
+        pos += res.length;
+    }
+    return 0;
+}
+
+Record getRecord(DecodedText *dec, unsigned int i)
+{
+    Record rec = {dec->offsets[i], dec->lengths[i], dec->typeIds[i], dec->operands[i]};
+    return rec;
+}
+
+Instruction recordInstruction(DecodedText *dec, char *text, unsigned int i)
+{
+    Record rec = getRecord(dec, i);
+    return recordToInstruction(&rec, text);
+}
+
+int recordTarget(const Record *rec, const char *text, unsigned int *target)
+{
+    if (rec->typeId == RECORD_UNDEFINED)
+        return 0;
+
+    pthread_once(&recordPlansOnce, compileRecordPlans);
+    int width = recordPlans[rec->typeId].targetWidth;
+    if (width == 0)
+        return 0;
+
+    const unsigned char *end = (const unsigned char *)text + rec->offset + rec->length;
+    int disp;
+    if (width == 2)
+        disp = end[-2] | end[-1] << 8;
+    else
+        disp = (signed char)end[-1];
+
+    *target = (rec->offset + rec->length + disp) & 0xffff;
+    return width;
+}
+
+unsigned int findRecord(DecodedText *dec, unsigned int offset)
+{
+    unsigned int lo = 0, hi = dec->count;
+    while (lo < hi) {
+        unsigned int mid = (lo + hi) / 2;
+        if (dec->offsets[mid] <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? lo - 1 : 0;
+}
+
+int formatRecords(OutBuffer *out, DecodedText *dec, char *text)
+{
+    for (unsigned int i = 0; i < dec->count; ++i) {
+        Instruction instr = recordInstruction(dec, text, i);
+        formatInstruction(out, dec->offsets[i], &instr);
+        outMaybeFlush(out);
+    }
+    return 0;
+}
+
+int formatRecordFile(OutBuffer *out, DecodedText *dec, const char *text, int textLen)
+{
+    uint32_t head[3] = {RECORD_FILE_VERSION, textLen, dec->count};
+    outWrite(out, "DREC", 4);
+    outWrite(out, (char *)head, sizeof(head));
+    outWrite(out, (char *)dec->offsets, sizeof(uint16_t) * dec->count);
+    outWrite(out, (char *)dec->lengths, sizeof(uint8_t) * dec->count);
+    outWrite(out, (char *)dec->typeIds, sizeof(uint8_t) * dec->count);
+    outWrite(out, (char *)dec->operands, sizeof(uint16_t) * dec->count);
+    outWrite(out, text, textLen);
+    return 0;
+}
+
+int writeRecords(const char *path, DecodedText *dec, const char *text, int textLen)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+
+    OutBuffer out;
+    int status = initOutBuffer(&out, file, OUT_BUFFER_SIZE);
+    if (status == 0) {
+        formatRecordFile(&out, dec, text, textLen);
+        status = outFlush(&out);
+        freeOutBuffer(&out);
+    }
+
+    if (status | fclose(file)) {
+        printf("cannot write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+// records from 0, each where the one before ends, inside the text, of a known type
+static int validRecords(const DecodedText *dec, int textLen)
+{
+    unsigned int end = 0;
+    for (unsigned int i = 0; i < dec->count; ++i) {
+        if (dec->offsets[i] != end || dec->lengths[i] == 0 || end + dec->lengths[i] > (unsigned int)textLen)
+            return 0;
+        if (dec->typeIds[i] >= NUM_OF_INSTRUCT_TYPES && dec->typeIds[i] != RECORD_UNDEFINED)
+            return 0;
+        end += dec->lengths[i];
+    }
+    return 1;
+}
+
+int readRecords(const char *path, DecodedText *dec, char **text, int *textLen)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+
+    char magic[4];
+    uint32_t head[3];
+    if (fread(magic, 1, 4, file) != 4 || memcmp(magic, "DREC", 4) != 0 ||
+        fread(head, sizeof(uint32_t), 3, file) != 3 || head[0] != RECORD_FILE_VERSION) {
+        printf("bad record file %s\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    unsigned int count = head[2];
+    *textLen = head[1];
+    *text = malloc(*textLen ? *textLen : 1);
+    if (*text == NULL || initDecodedText(dec, count) != 0) {
+        free(*text);
+        fclose(file);
+        return 1;
+    }
+
+    dec->count = count;
+    if (fread(dec->offsets, sizeof(uint16_t), count, file) != count ||
+        fread(dec->lengths, sizeof(uint8_t), count, file) != count ||
+        fread(dec->typeIds, sizeof(uint8_t), count, file) != count ||
+        fread(dec->operands, sizeof(uint16_t), count, file) != count ||
+        fread(*text, 1, *textLen, file) != *textLen) {
+        printf("truncated record file %s\n", path);
+        freeDecodedText(dec);
+        free(*text);
+        fclose(file);
+        return 1;
+    }
+    fclose(file);
+
+    if (!validRecords(dec, *textLen)) {
+        printf("bad record file %s\n", path);
+        freeDecodedText(dec);
+        free(*text);
+        return 1;
+    }
+    return 0;
+}
+
+static int copyRecords(DecodedText *dec, DecodedText *old, unsigned int from, unsigned int to)
+{
+    unsigned int n = to - from;
+    while (dec->count + n > dec->capacity)
+        if (growDecodedText(dec) != 0)
+            return 1;
+    memcpy(dec->offsets + dec->count, old->offsets + from, n * sizeof(uint16_t));
+    memcpy(dec->lengths + dec->count, old->lengths + from, n * sizeof(uint8_t));
+    memcpy(dec->typeIds + dec->count, old->typeIds + from, n * sizeof(uint8_t));
+    memcpy(dec->operands + dec->count, old->operands + from, n * sizeof(uint16_t));
+    dec->count += n;
+    return 0;
+}
+
+// first changed byte at or after pos, textLen if none
+static int nextChange(const char *oldText, const char *text, int textLen, int pos)
+{
+    while (pos + CHANGE_BLOCK_LEN <= textLen &&
+           memcmp(oldText + pos, text + pos, CHANGE_BLOCK_LEN) == 0)
+        pos += CHANGE_BLOCK_LEN;
+    while (pos < textLen && oldText[pos] == text[pos])
+        ++pos;
+    return pos;
+}
+
+// first unchanged byte at or after pos
+static int nextSame(const char *oldText, const char *text, int textLen, int pos)
+{
+    while (pos < textLen && oldText[pos] != text[pos])
+        ++pos;
+    return pos;
+}
+
+int redecodeText(DecodedText *old, const char *oldText, int oldLen,
+                 char *text, int textLen, DecodedText *dec)
+{
+    if (oldLen != textLen || old->count == 0) {
+        // not patched in place, nothing to reuse
+        unsigned int before = dec->count;
+        if (decodeText(text, textLen, dec) != 0)
+            return -1;
+        return dec->count - before;
+    }
+
+    int decoded = 0;
+    unsigned int next = 0; // first old record not copied nor superseded
+    int change = nextChange(oldText, text, textLen, 0);
+
+    while (change < textLen) {
+        unsigned int start = findRecord(old, change);
+        if (start < next)
+            start = next;
+        if (copyRecords(dec, old, next, start) != 0)
+            return -1;
+
+        int changeEnd = nextSame(oldText, text, textLen, change);
+        unsigned int pos = old->offsets[start];
+        next = old->count;
+        while (pos < textLen) {
+            PROFILE_BEGIN(PROF_DECODE);
+            Instruction res = readInstruction(text, textLen, pos);
+            PROFILE_END(PROF_DECODE);
+            PROFILE_COUNT(PROF_INSTRUCTIONS, 1);
+            if (res.length == 0 || appendRecord(dec, pos, &res) != 0)
+                return -1;
+            ++decoded;
+            pos += res.length;
+
+            // the changes this instruction ran over
+            while (changeEnd < textLen && changeEnd < pos) {
+                change = nextChange(oldText, text, textLen, changeEnd);
+                if (change >= pos)
+                    break;
+                changeEnd = nextSame(oldText, text, textLen, change);
+            }
+            if (pos < changeEnd)
+                continue;
+
+            // back in step with the old boundaries
+            unsigned int i = findRecord(old, pos);
+            if (old->offsets[i] == pos) {
+                next = i;
+                break;
+            }
+        }
+
+        change = nextChange(oldText, text, textLen, pos);
+    }
+
+    if (copyRecords(dec, old, next, old->count) != 0)
+        return -1;
+    return decoded;
+}
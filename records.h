@@ -0,0 +1,246 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include "instruction.h"
+#include "output.h"
+#include <stdint.h>
+
+/*
+ * --- DECODED RECORDS ---
+ *
+ * A whole text segment decoded in bulk, as structure of arrays :
+ * 6 bytes per instruction instead of a full Instruction.
+ *
+ * offset   : position of the instruction in the segment
+ * length   : length of the instruction in bytes
+ * typeId   : index in instructionTypes, RECORD_UNDEFINED if no match
+ * operands : packed operand descriptor
+ *   bits  0-2  : r/m (ModRM)
+ *   bits  3-5  : reg (ModRM), or the r / s field of the opcode
+ *   bits  6-7  : mod (ModRM)
+ *   bit   8    : has a ModRM byte
+ *   bit   9    : w
+ *   bit  10    : d
+ *   bit  11    : s (W = 11, sign extended byte of data)
+ *   bits 12-13 : length of the ModRM displacement (0, 1 or 2)
+ *
+ * --- RECORD FILE ---
+ *
+ * The records and the text they were decoded from, in host byte order :
+ *   char magic[4]       "DREC"
+ *   uint32_t version    RECORD_FILE_VERSION
+ *   uint32_t textLen
+ *   uint32_t count
+ *   uint16_t offsets[count], uint8_t lengths[count],
+ *   uint8_t typeIds[count], uint16_t operands[count]
+ *   char text[textLen]
+ */
+
+#define RECORD_UNDEFINED 0xff
+#define RECORD_FILE_VERSION 1
+
+#define OPERANDS_RM(op) ((op) & 0x7)
+#define OPERANDS_REG(op) (((op) >> 3) & 0x7)
+#define OPERANDS_MOD(op) (((op) >> 6) & 0x3)
+#define OPERANDS_HAS_MODRM(op) (((op) >> 8) & 0x1)
+#define OPERANDS_W(op) (((op) >> 9) & 0x1)
+#define OPERANDS_D(op) (((op) >> 10) & 0x1)
+#define OPERANDS_S(op) (((op) >> 11) & 0x1)
+#define OPERANDS_DISP_LEN(op) (((op) >> 12) & 0x3)
+
+/**
+ * @brief One decoded instruction, as stored in a DecodedText
+ * @param offset uint16_t
+ * @param length uint8_t
+ * @param typeId uint8_t
+ * @param operands uint16_t
+ */
+typedef struct RecordStruct {
+    uint16_t offset;
+    uint8_t length;
+    uint8_t typeId;
+    uint16_t operands;
+} Record;
+
+/**
+ * @brief A decoded text segment
+ * @param offsets uint16_t*
+ * @param lengths uint8_t*
+ * @param typeIds uint8_t*
+ * @param operands uint16_t*
+ * @param count unsigned int number of instructions
+ * @param capacity unsigned int allocated entries
+ */
+typedef struct DecodedTextStruct {
+    uint16_t *offsets;
+    uint8_t *lengths;
+    uint8_t *typeIds;
+    uint16_t *operands;
+    unsigned int count;
+    unsigned int capacity;
+} DecodedText;
+
+/**
+ * @brief Initialise an empty decoded text
+ *
+ * @param dec DecodedText*
+ * @param capacity unsigned int entries to allocate up front
+ * @return int 0 on success, 1 on allocation failure
+ */
+int initDecodedText(DecodedText *dec, unsigned int capacity);
+
+/**
+ * @brief Free the arrays of a decoded text
+ *
+ * @param dec DecodedText*
+ */
+void freeDecodedText(DecodedText *dec);
+
+/**
+ * @brief Append a decoded instruction
+ *
+ * @param dec DecodedText*
+ * @param pos unsigned int
+ * @param instr Instruction*
+ * @return int 0 on success, 1 on allocation failure
+ */
+int appendRecord(DecodedText *dec, unsigned int pos, Instruction *instr);
+
+/**
+ * @brief Pack the operand fields of an instruction
+ *
+ * @param instr Instruction*
+ * @return uint16_t the operand descriptor
+ */
+uint16_t packOperands(Instruction *instr);
+
+/**
+ * @brief Make the record of a decoded instruction
+ *
+ * @param pos unsigned int
+ * @param instr Instruction*
+ * @return Record
+ */
+Record makeRecord(unsigned int pos, Instruction *instr);
+
+/**
+ * @brief Rebuild the full instruction of a record, to print it
+ *
+ * @param rec const Record*
+ * @param text char* the segment the record was decoded from
+ * @return Instruction
+ */
+Instruction recordToInstruction(const Record *rec, char *text);
+
+/**
+ * @brief Get the target of a relative jump, call or loop ($P), the
+ * displacement is the last 1 or 2 bytes of the instruction
+ *
+ * @param rec const Record*
+ * @param text const char*
+ * @param target unsigned int* set to the target offset
+ * @return int the length of the displacement, 0 if there is none
+ */
+int recordTarget(const Record *rec, const char *text, unsigned int *target);
+
+/**
+ * @brief Decode a whole text segment into records
+ *
+ * @param text char*
+ * @param textLen int
+ * @param dec DecodedText* initialised, records are appended
+ * @return int 0 on success, 1 on error (message printed for a text over
+ * 64 KiB), the records before a zero length instruction are kept
+ */
+int decodeText(char *text, int textLen, DecodedText *dec);
+
+/**
+ * @brief Rebuild the full instruction of a record, to print it
+ *
+ * @param dec DecodedText*
+ * @param text char* the segment the records were decoded from
+ * @param i unsigned int index of the record
+ * @return Instruction
+ */
+Instruction recordInstruction(DecodedText *dec, char *text, unsigned int i);
+
+/**
+ * @brief Find the last record at or before an offset
+ *
+ * @param dec DecodedText*
+ * @param offset unsigned int
+ * @return unsigned int its index, 0 if none
+ */
+unsigned int findRecord(DecodedText *dec, unsigned int offset);
+
+/**
+ * @brief Get a record of a decoded text
+ *
+ * @param dec DecodedText*
+ * @param i unsigned int
+ * @return Record
+ */
+Record getRecord(DecodedText *dec, unsigned int i);
+
+/**
+ * @brief List the records, as disassembleText would
+ *
+ * @param out OutBuffer*
+ * @param dec DecodedText*
+ * @param text char*
+ * @return int 0 on success
+ */
+int formatRecords(OutBuffer *out, DecodedText *dec, char *text);
+
+/**
+ * @brief Write a record file into a buffer
+ *
+ * @param out OutBuffer*
+ * @param dec DecodedText*
+ * @param text const char*
+ * @param textLen int
+ * @return int 0 on success
+ */
+int formatRecordFile(OutBuffer *out, DecodedText *dec, const char *text, int textLen);
+
+/**
+ * @brief Save records and their text to a record file
+ *
+ * @param path const char*
+ * @param dec DecodedText*
+ * @param text const char*
+ * @param textLen int
+ * @return int 0 on success, 1 on error (message printed)
+ */
+int writeRecords(const char *path, DecodedText *dec, const char *text, int textLen);
+
+/**
+ * @brief Load a record file, rejecting records that do not follow each
+ * other from 0 inside the text or have an unknown type
+ *
+ * @param path const char*
+ * @param dec DecodedText* not initialised
+ * @param text char** the text (allocated)
+ * @param textLen int*
+ * @return int 0 on success, 1 on error (message printed)
+ */
+int readRecords(const char *path, DecodedText *dec, char **text, int *textLen);
+
+/**
+ * @brief Decode a patched text reusing the records of the previous one :
+ * only from the last known boundary before each changed range, up to the
+ * first old boundary after it
+ *
+ * @param old DecodedText* records of oldText
+ * @param oldText const char*
+ * @param oldLen int
+ * @param text char* the new text
+ * @param textLen int
+ * @param dec DecodedText* initialised, records are appended
+ * @return int number of instructions decoded, -1 on error, the records
+ * before a zero length instruction are kept
+ */
+int redecodeText(DecodedText *old, const char *oldText, int oldLen,
+                 char *text, int textLen, DecodedText *dec);
+
+#endif
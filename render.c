@@ -0,0 +1,114 @@
+#include "render.h"
+#include "cycles.h"
+#include "datadump.h"
+#include "disasembler.h"
+#include "records.h"
+#include "runs.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *formatNames[NUM_OF_FORMATS] = {"text", "json", "records"};
+
+int parseRenderFormat(const char *name)
+{
+    for (int i = 0; i < NUM_OF_FORMATS; ++i)
+        if (strcmp(name, formatNames[i]) == 0)
+            return i;
+    return -1;
+}
+
+static void outJsonStr(OutBuffer *out, const char *str, size_t len)
+{
+    outChar(out, '"');
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = str[i];
+        if (c < 0x20) {
+            // control characters as \u00XX
+            outWrite(out, "\\u00", 4);
+            outHex(out, (const char *)&c, 1);
+        } else {
+            if (c == '"' || c == '\\')
+                outChar(out, '\\');
+            outChar(out, c);
+        }
+    }
+    outChar(out, '"');
+}
+
+static int renderJson(OutBuffer *out, Image *img, ListingStats *stats)
+{
+    OutBuffer line;
+    if (initOutBuffer(&line, NULL, 128) != 0)
+        return 1;
+
+    char num[16];
+    unsigned int pos = 0;
+    outChar(out, '[');
+    while (pos < img->textLen) {
+        Instruction instr = readInstruction(img->text, img->textLen, pos);
+        if (instr.length == 0)
+            break;
+        countListed(stats, instr.type == NULL);
+
+        // "%04x: %-13s text\n" -> text
+        line.len = 0;
+        formatInstruction(&line, pos, &instr);
+        size_t bytesWidth = 2 * instr.length < 13 ? 13 : 2 * instr.length;
+        size_t textStart = (char *)memchr(line.data, ':', line.len) - line.data + 2 + bytesWidth + 1;
+
+        if (pos != 0)
+            outChar(out, ',');
+        outWrite(out, "\n{\"addr\": ", 10);
+        outWrite(out, num, snprintf(num, sizeof(num), "%u", pos));
+        outWrite(out, ", \"bytes\": \"", 12);
+        outHex(out, instr.data, instr.length);
+        outWrite(out, "\", \"text\": ", 11);
+        outJsonStr(out, line.data + textStart, line.len - 1 - textStart);
+        outChar(out, '}');
+        outMaybeFlush(out);
+        pos += instr.length;
+    }
+    outWrite(out, "\n]\n", 3);
+
+    freeOutBuffer(&line);
+    return pos < img->textLen;
+}
+
+int renderImage(OutBuffer *out, Image *img, int options, RenderFormat format, ListingStats *stats)
+{
+    int status = 1;
+    DecodedText dec;
+
+    switch (format) {
+    case FORMAT_TEXT:
+        if (options & RENDER_CYCLES)
+            status = listCycles(out, img, stats);
+        else if (options & RENDER_RUNS)
+            status = disassembleRuns(out, img->text, img->textLen, stats);
+        else
+            status = disassembleText(out, img->text, img->textLen, stats);
+        if (status == 0 && (options & RENDER_DATA))
+            status = dumpData(out, img);
+        break;
+
+    case FORMAT_JSON:
+        status = renderJson(out, img, stats);
+        break;
+
+    case FORMAT_RECORDS:
+        if (initDecodedText(&dec, img->textLen / 3) != 0)
+            return 1;
+        status = decodeText(img->text, img->textLen, &dec);
+        for (unsigned int i = 0; i < dec.count; ++i)
+            countListed(stats, dec.typeIds[i] == RECORD_UNDEFINED);
+        if (status == 0)
+            status = formatRecordFile(out, &dec, img->text, img->textLen);
+        freeDecodedText(&dec);
+        break;
+
+    default:
+        break;
+    }
+
+    return status;
+}
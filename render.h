@@ -0,0 +1,40 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "disasembler.h"
+#include "image.h"
+#include "output.h"
+
+#define RENDER_DATA 0x1   // list the data and bss segments too (text format)
+#define RENDER_CYCLES 0x2 // with the clock counts, as --cycles (text format)
+#define RENDER_RUNS 0x4   // with the zero and string runs, as --runs (text format)
+
+/// @brief What a listing is rendered as
+typedef enum RenderFormatEnum {
+    FORMAT_TEXT,    // the listing
+    FORMAT_JSON,    // [{"addr": 0, "bytes": "31ed", "text": "xor bp, bp"}, ...]
+    FORMAT_RECORDS, // a record file (records.h)
+    NUM_OF_FORMATS
+} RenderFormat;
+
+/**
+ * @brief Parse a format name, "text", "json" or "records"
+ *
+ * @param name const char*
+ * @return int the RenderFormat, -1 if unknown
+ */
+int parseRenderFormat(const char *name);
+
+/**
+ * @brief Render the text segment of an image
+ *
+ * @param out OutBuffer*
+ * @param img Image*
+ * @param options int RENDER_ flags
+ * @param format RenderFormat
+ * @param stats ListingStats* counted, or NULL
+ * @return int 0 on success, 1 on error
+ */
+int renderImage(OutBuffer *out, Image *img, int options, RenderFormat format, ListingStats *stats);
+
+#endif
@@ -0,0 +1,69 @@
+#include "ring.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+// spins before giving the core away
+#define RING_SPINS 64
+
+int initRing(SpscRing *ring, size_t capacity, size_t elemSize)
+{
+    size_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->cachedTail = 0;
+    ring->cachedHead = 0;
+    ring->mask = cap - 1;
+    ring->elemSize = elemSize;
+    ring->slots = malloc(cap * elemSize);
+    return ring->slots == NULL;
+}
+
+void freeRing(SpscRing *ring)
+{
+    free(ring->slots);
+    ring->slots = NULL;
+}
+
+int ringPush(SpscRing *ring, const void *elem)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->cachedTail > ring->mask) {
+        ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->cachedTail > ring->mask)
+            return 1;
+    }
+    memcpy(ring->slots + (head & ring->mask) * ring->elemSize, elem, ring->elemSize);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 0;
+}
+
+int ringPop(SpscRing *ring, void *elem)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == ring->cachedHead) {
+        ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->cachedHead)
+            return 1;
+    }
+    memcpy(elem, ring->slots + (tail & ring->mask) * ring->elemSize, ring->elemSize);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 0;
+}
+
+void ringPushWait(SpscRing *ring, const void *elem)
+{
+    for (int spins = 0; ringPush(ring, elem) != 0; ++spins)
+        if (spins >= RING_SPINS)
+            sched_yield();
+}
+
+void ringPopWait(SpscRing *ring, void *elem)
+{
+    for (int spins = 0; ringPop(ring, elem) != 0; ++spins)
+        if (spins >= RING_SPINS)
+            sched_yield();
+}
@@ -0,0 +1,77 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define RING_CACHE_LINE 64
+
+/*
+ * --- SPSC RING ---
+ *
+ * Lock-free queue between exactly one producer thread and one consumer
+ * thread. head is only written by the producer, tail only by the consumer,
+ * each on its own cache line, and each side keeps a cached copy of the
+ * other index so it only reads the shared one when the ring looks full
+ * or empty.
+ */
+
+/**
+ * @brief A single producer, single consumer ring of fixed size elements
+ * @param head size_t next slot written (producer)
+ * @param tail size_t next slot read (consumer)
+ * @param mask size_t capacity - 1, the capacity is a power of 2
+ * @param elemSize size_t
+ * @param slots char*
+ */
+typedef struct SpscRingStruct {
+    _Alignas(RING_CACHE_LINE) atomic_size_t head;
+    size_t cachedTail;
+    _Alignas(RING_CACHE_LINE) atomic_size_t tail;
+    size_t cachedHead;
+    _Alignas(RING_CACHE_LINE) size_t mask;
+    size_t elemSize;
+    char *slots;
+} SpscRing;
+
+/**
+ * @brief Initialise a ring
+ *
+ * @param ring SpscRing*
+ * @param capacity size_t rounded up to a power of 2
+ * @param elemSize size_t
+ * @return int 0 on success, 1 on allocation failure
+ */
+int initRing(SpscRing *ring, size_t capacity, size_t elemSize);
+
+void freeRing(SpscRing *ring);
+
+/**
+ * @brief Copy an element in, producer side
+ *
+ * @param ring SpscRing*
+ * @param elem const void*
+ * @return int 0 on success, 1 if the ring is full
+ */
+int ringPush(SpscRing *ring, const void *elem);
+
+/**
+ * @brief Copy an element out, consumer side
+ *
+ * @param ring SpscRing*
+ * @param elem void*
+ * @return int 0 on success, 1 if the ring is empty
+ */
+int ringPop(SpscRing *ring, void *elem);
+
+/**
+ * @brief Push, waiting while the ring is full
+ */
+void ringPushWait(SpscRing *ring, const void *elem);
+
+/**
+ * @brief Pop, waiting while the ring is empty
+ */
+void ringPopWait(SpscRing *ring, void *elem);
+
+#endif
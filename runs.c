@@ -0,0 +1,247 @@
+#include "runs.h"
+#include "datadump.h"
+#include "disasembler.h"
+#include "profile.h"
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RUNS_X86
+#endif
+
+static void classifyScalar(const unsigned char *src, size_t len, uint32_t *zero, uint32_t *printable)
+{
+    for (size_t i = 0; i < len; i += 32) {
+        uint32_t z = 0, p = 0;
+        for (size_t j = 0; j < 32 && i + j < len; ++j) {
+            z |= (uint32_t)(src[i + j] == 0) << j;
+            p |= (uint32_t)isPrintable(src[i + j]) << j;
+        }
+        zero[i / 32] = z;
+        printable[i / 32] = p;
+    }
+}
+
+#ifdef RUNS_X86
+
+__attribute__((target("sse2"))) static void classifySSE2(const unsigned char *src, size_t len, uint32_t *zero, uint32_t *printable)
+{
+    const __m128i nul = _mm_setzero_si128();
+    const __m128i low = _mm_set1_epi8(0x1f);
+    const __m128i del = _mm_set1_epi8(0x7f);
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        uint32_t z = 0, p = 0;
+        for (int half = 0; half < 2; ++half) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i + 16 * half));
+            // signed compares, the bytes from 0x80 are below 0x1f
+            __m128i print = _mm_and_si128(_mm_cmpgt_epi8(v, low), _mm_cmplt_epi8(v, del));
+            print = _mm_or_si128(print, _mm_or_si128(_mm_cmpeq_epi8(v, nl),
+                                                     _mm_or_si128(_mm_cmpeq_epi8(v, tab), _mm_cmpeq_epi8(v, cr))));
+            z |= (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nul)) << (16 * half);
+            p |= (uint32_t)_mm_movemask_epi8(print) << (16 * half);
+        }
+        zero[i / 32] = z;
+        printable[i / 32] = p;
+    }
+    classifyScalar(src + i, len - i, zero + i / 32, printable + i / 32);
+}
+
+__attribute__((target("avx2"))) static void classifyAVX2(const unsigned char *src, size_t len, uint32_t *zero, uint32_t *printable)
+{
+    const __m256i nul = _mm256_setzero_si256();
+    const __m256i low = _mm256_set1_epi8(0x1f);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i print = _mm256_and_si256(_mm256_cmpgt_epi8(v, low), _mm256_cmpgt_epi8(del, v));
+        print = _mm256_or_si256(print, _mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+                                                       _mm256_or_si256(_mm256_cmpeq_epi8(v, tab), _mm256_cmpeq_epi8(v, cr))));
+        zero[i / 32] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nul));
+        printable[i / 32] = (uint32_t)_mm256_movemask_epi8(print);
+    }
+    classifyScalar(src + i, len - i, zero + i / 32, printable + i / 32);
+}
+
+#endif
+
+static void (*classifyKernel)(const unsigned char *, size_t, uint32_t *, uint32_t *) = classifyScalar;
+static pthread_once_t classifyOnce = PTHREAD_ONCE_INIT;
+
+static void selectClassifyKernel(void)
+{
+#ifdef RUNS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        classifyKernel = classifyAVX2;
+    else if (__builtin_cpu_supports("sse2"))
+        classifyKernel = classifySSE2;
+#endif
+}
+
+void classifyBytes(const unsigned char *src, size_t len, uint32_t *zero, uint32_t *printable)
+{
+    pthread_once(&classifyOnce, selectClassifyKernel);
+    classifyKernel(src, len, zero, printable);
+}
+
+/**
+ * @brief First position from pos where the bit is set (or clear), len if none
+ */
+static unsigned int nextBit(const uint32_t *map, unsigned int pos, unsigned int len, int set)
+{
+    if (pos >= len)
+        return len;
+    unsigned int i = pos / 32;
+    uint32_t word = (set ? map[i] : ~map[i]) & (~0u << (pos % 32));
+    while (word == 0) {
+        if (++i * 32 >= len)
+            return len;
+        word = set ? map[i] : ~map[i];
+    }
+    pos = i * 32 + __builtin_ctz(word);
+    return pos < len ? pos : len;
+}
+
+// mostly letters, digits and spaces : code that happens to be printable
+// is a mix of anything from 0x20 to 0x7e
+static int textLike(const char *str, unsigned int len)
+{
+    unsigned int words = 0;
+    for (unsigned int i = 0; i < len; ++i)
+        words += isalnum((unsigned char)str[i]) || str[i] == ' ';
+    return 4 * words >= 3 * len;
+}
+
+static int appendRun(TextRuns *runs, unsigned int offset, unsigned int length, int kind)
+{
+    if (runs->count == runs->capacity) {
+        unsigned int capacity = runs->capacity ? 2 * runs->capacity : 64;
+        TextRun *grown = realloc(runs->runs, sizeof(TextRun) * capacity);
+        if (grown == NULL)
+            return 1;
+        runs->runs = grown;
+        runs->capacity = capacity;
+    }
+    TextRun run = {offset, length, kind};
+    runs->runs[runs->count++] = run;
+    return 0;
+}
+
+int scanRuns(const char *text, int textLen, TextRuns *runs)
+{
+    memset(runs, 0, sizeof(TextRuns));
+    unsigned int len = textLen > 0 ? textLen : 0;
+    unsigned int words = (len + 31) / 32;
+    uint32_t *zero = malloc(sizeof(uint32_t) * (words ? words : 1));
+    uint32_t *printable = malloc(sizeof(uint32_t) * (words ? words : 1));
+    if (zero == NULL || printable == NULL) {
+        free(zero);
+        free(printable);
+        return 1;
+    }
+    classifyBytes((const unsigned char *)text, len, zero, printable);
+
+    int status = 0;
+    unsigned int pos = 0;
+    while (pos < len && status == 0) {
+        unsigned int z = nextBit(zero, pos, len, 1);
+        unsigned int p = nextBit(printable, pos, len, 1);
+        if (z >= len && p >= len)
+            break;
+
+        if (z < p) {
+            unsigned int end = nextBit(zero, z, len, 0);
+            if (end - z >= RUN_ZERO_MIN)
+                status = appendRun(runs, z, end - z, RUN_ZERO);
+            pos = end;
+        } else {
+            unsigned int end = nextBit(printable, p, len, 0);
+            unsigned int n = end - p >= RUN_ASCII_MIN ? asciiRunLength(text + p, len - p, RUN_ASCII_MIN) : 0;
+            if (n > 0 && textLike(text + p, end - p)) {
+                status = appendRun(runs, p, n, RUN_ASCII);
+                end = p + n;
+            }
+            pos = end;
+        }
+    }
+
+    free(zero);
+    free(printable);
+    if (status != 0)
+        freeRuns(runs);
+    return status;
+}
+
+void freeRuns(TextRuns *runs)
+{
+    free(runs->runs);
+    memset(runs, 0, sizeof(TextRuns));
+}
+
+int disassembleRuns(OutBuffer *out, char *text, int textLen, ListingStats *stats)
+{
+    TextRuns runs;
+    if (scanRuns(text, textLen, &runs) != 0)
+        return 1;
+
+    unsigned int pos = 0, r = 0;
+    while (pos < textLen) {
+        while (r < runs.count && runs.runs[r].offset + runs.runs[r].length <= pos)
+            ++r;
+        // an instruction may have ended inside the run, list what is left of it
+        if (r < runs.count && runs.runs[r].offset <= pos) {
+            TextRun *run = runs.runs + r++;
+            unsigned int len = run->offset + run->length - pos;
+            if (run->kind == RUN_ZERO && len >= RUN_ZERO_MIN) {
+                char line[32];
+                outAddr(out, pos);
+                outWrite(out, line, snprintf(line, sizeof(line), ": .space %u\n", len));
+                pos += len;
+                continue;
+            }
+            if (run->kind == RUN_ASCII && len >= RUN_ASCII_MIN) {
+                dumpAscii(out, pos, text + pos, len);
+                outMaybeFlush(out);
+                pos += len;
+                continue;
+            }
+        }
+
+        // a string is taken as data, the instruction before it is cut at its start
+        int limit = textLen;
+        if (r < runs.count && runs.runs[r].kind == RUN_ASCII)
+            limit = runs.runs[r].offset;
+
+        PROFILE_BEGIN(PROF_DECODE);
+        Instruction res = readInstruction(text, limit, pos);
+        PROFILE_END(PROF_DECODE);
+        PROFILE_COUNT(PROF_INSTRUCTIONS, 1);
+        if (res.length == 0) {
+            outStr(out, "zero length instruction\n");
+            outFlush(out);
+            freeRuns(&runs);
+            return 1;
+        }
+        countListed(stats, res.type == NULL);
+        formatInstruction(out, pos, &res);
+        outMaybeFlush(out);
+        pos += res.length;
+    }
+
+    freeRuns(&runs);
+    return 0;
+}
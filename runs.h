@@ -0,0 +1,99 @@
+#ifndef RUNS_H
+#define RUNS_H
+
+#include "disasembler.h"
+#include "output.h"
+#include <stdint.h>
+
+/*
+ * --- RUNS ---
+ *
+ * Zero fill and strings in a text segment, found before decoding so the
+ * sweep can step over them instead of listing them as add [bx+si], al or
+ * (undefined) one instruction at a time.
+ *
+ * The bytes are first classified 32 at a time into two bitmaps, zero and
+ * printable (0x20-0x7e, \n \t \r), by an SSE2 or AVX2 kernel picked at run
+ * time (scalar elsewhere). The runs are then read from the bitmaps with
+ * bit scans :
+ *   RUN_ZERO  : at least RUN_ZERO_MIN zero bytes, listed as .space N
+ *   RUN_ASCII : at least RUN_ASCII_MIN printable bytes ended by a zero,
+ *               mostly letters, digits and spaces, listed as .ascii
+ *               with the zero
+ * An instruction running into a string is cut at its start and listed as
+ * (undefined); one running into zero fill keeps its bytes, and only what
+ * is left of the run is listed.
+ *
+ * Dense random looking data (tables, compressed blobs) is not detected,
+ * it can not be told from code by a byte scan.
+ */
+
+#define RUN_ZERO 0
+#define RUN_ASCII 1
+
+#define RUN_ZERO_MIN 16
+#define RUN_ASCII_MIN 16
+
+/**
+ * @brief A run of zero fill or string bytes
+ * @param offset unsigned int
+ * @param length unsigned int
+ * @param kind int RUN_ZERO or RUN_ASCII
+ */
+typedef struct TextRunStruct {
+    unsigned int offset;
+    unsigned int length;
+    int kind;
+} TextRun;
+
+/**
+ * @brief The runs of a text segment, in order
+ * @param runs TextRun*
+ * @param count unsigned int
+ * @param capacity unsigned int
+ */
+typedef struct TextRunsStruct {
+    TextRun *runs;
+    unsigned int count;
+    unsigned int capacity;
+} TextRuns;
+
+/**
+ * @brief Classify bytes, bit i % 32 of word i / 32 is set for byte i
+ *
+ * @param src const unsigned char*
+ * @param len size_t
+ * @param zero uint32_t* (len + 31) / 32 words
+ * @param printable uint32_t* (len + 31) / 32 words
+ */
+void classifyBytes(const unsigned char *src, size_t len, uint32_t *zero, uint32_t *printable);
+
+/**
+ * @brief Find the zero and string runs of a text
+ *
+ * @param text const char*
+ * @param textLen int
+ * @param runs TextRuns* initialized here
+ * @return int 0 on success, 1 on allocation failure
+ */
+int scanRuns(const char *text, int textLen, TextRuns *runs);
+
+/**
+ * @brief Free the runs
+ *
+ * @param runs TextRuns*
+ */
+void freeRuns(TextRuns *runs);
+
+/**
+ * @brief Disassemble a text, listing its runs as .space and .ascii
+ *
+ * @param out OutBuffer*
+ * @param text char*
+ * @param textLen int
+ * @param stats ListingStats* counted, or NULL
+ * @return int 0 on success, 1 on error
+ */
+int disassembleRuns(OutBuffer *out, char *text, int textLen, ListingStats *stats);
+
+#endif
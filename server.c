@@ -0,0 +1,377 @@
+#include "server.h"
+#include "image.h"
+#include "output.h"
+#include "render.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct CacheEntryStruct {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    uint32_t options;
+    uint32_t format;
+    char *payload;
+    size_t len;
+} CacheEntry;
+
+static CacheEntry cache[SERVER_CACHE_ENTRIES];
+static int cacheNext = 0;
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+static int listenFd = -1;
+static volatile sig_atomic_t stopping = 0;
+
+static int readFull(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int writeFull(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return 1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static int sameEntry(CacheEntry *entry, const char *path, struct stat *st, ServerRequest *req)
+{
+    return entry->path && strcmp(entry->path, path) == 0 &&
+           entry->dev == st->st_dev && entry->ino == st->st_ino && entry->size == st->st_size &&
+           entry->mtime.tv_sec == st->st_mtim.tv_sec && entry->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           entry->options == req->options && entry->format == req->format;
+}
+
+// copies the cached payload into out, 0 if found
+static int cacheLookup(const char *path, struct stat *st, ServerRequest *req, OutBuffer *out)
+{
+    int status = 1;
+    pthread_mutex_lock(&cacheLock);
+    for (int i = 0; i < SERVER_CACHE_ENTRIES; ++i) {
+        if (sameEntry(cache + i, path, st, req)) {
+            outWrite(out, cache[i].payload, cache[i].len);
+            status = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cacheLock);
+    return status;
+}
+
+static void cacheStore(const char *path, struct stat *st, ServerRequest *req, OutBuffer *out)
+{
+    if (out->len > SERVER_CACHE_MAX_PAYLOAD)
+        return;
+
+    char *pathCopy = strdup(path);
+    char *payload = malloc(out->len ? out->len : 1);
+    if (pathCopy == NULL || payload == NULL) {
+        free(pathCopy);
+        free(payload);
+        return;
+    }
+    memcpy(payload, out->data, out->len);
+
+    pthread_mutex_lock(&cacheLock);
+    CacheEntry *entry = cache + cacheNext;
+    cacheNext = (cacheNext + 1) % SERVER_CACHE_ENTRIES;
+    free(entry->path);
+    free(entry->payload);
+    entry->path = pathCopy;
+    entry->dev = st->st_dev;
+    entry->ino = st->st_ino;
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtim;
+    entry->options = req->options;
+    entry->format = req->format;
+    entry->payload = payload;
+    entry->len = out->len;
+    pthread_mutex_unlock(&cacheLock);
+}
+
+// a json or record file cut short is no use, the client gets the error
+static int renderRequest(OutBuffer *out, Image *img, ServerRequest *req)
+{
+    int status = renderImage(out, img, req->options, req->format, NULL);
+    if (status != 0 && req->format != FORMAT_TEXT) {
+        out->len = 0;
+        outStr(out, "cannot decode the text\n");
+    }
+    return status;
+}
+
+static int renderPath(const char *path, ServerRequest *req, OutBuffer *out)
+{
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        outStr(out, "cannot open ");
+        outStr(out, path);
+        outChar(out, '\n');
+        return 1;
+    }
+    if (cacheLookup(path, &st, req, out) == 0)
+        return 0;
+
+    Image img;
+    if (openImage(path, &img) != 0) {
+        outStr(out, "cannot load ");
+        outStr(out, path);
+        outChar(out, '\n');
+        return 1;
+    }
+    int status = renderRequest(out, &img, req);
+    closeImage(&img);
+
+    if (status == 0)
+        cacheStore(path, &st, req, out);
+    return status;
+}
+
+static int renderBytes(int fd, ServerRequest *req, OutBuffer *out)
+{
+    char *bytes = malloc(req->bytesLen);
+    if (bytes == NULL || readFull(fd, bytes, req->bytesLen) != 0) {
+        free(bytes);
+        return 1;
+    }
+
+    Image img;
+    int status = 1;
+    if (loadImage(bytes, req->bytesLen, &img) == 0) {
+        status = renderRequest(out, &img, req);
+        closeImage(&img);
+    } else {
+        outStr(out, "bad a.out\n");
+    }
+
+    free(bytes);
+    return status;
+}
+
+static void handleConnection(int fd, OutBuffer *out)
+{
+    ServerRequest req;
+    char path[PATH_MAX];
+    uint32_t head[2] = {1, 0};
+
+    out->len = 0;
+    if (readFull(fd, &req, sizeof(req)) != 0 || req.magic != SERVER_MAGIC ||
+        req.format >= NUM_OF_FORMATS || req.pathLen >= PATH_MAX ||
+        req.bytesLen > SERVER_MAX_REQUEST || (req.pathLen == 0) == (req.bytesLen == 0)) {
+        outStr(out, "bad request\n");
+    } else if (req.pathLen > 0) {
+        if (readFull(fd, path, req.pathLen) == 0) {
+            path[req.pathLen] = '\0';
+            head[0] = renderPath(path, &req, out);
+        }
+    } else {
+        head[0] = renderBytes(fd, &req, out);
+    }
+
+    head[1] = out->len;
+    if (writeFull(fd, head, sizeof(head)) == 0)
+        writeFull(fd, out->data, out->len);
+}
+
+static void *workerThread(void *arg)
+{
+    OutBuffer out;
+    if (initOutBuffer(&out, NULL, OUT_BUFFER_SIZE) != 0)
+        return NULL;
+
+    while (!stopping) {
+        int fd = accept(listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        // a client that stops sending or reading only holds its thread for a while
+        struct timeval timeout = {SERVER_IO_TIMEOUT, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        handleConnection(fd, &out);
+        close(fd);
+        // do not keep a huge buffer around after a huge request
+        if (out.cap > SERVER_CACHE_MAX_PAYLOAD) {
+            freeOutBuffer(&out);
+            initOutBuffer(&out, NULL, OUT_BUFFER_SIZE);
+        }
+    }
+
+    freeOutBuffer(&out);
+    return NULL;
+}
+
+static void stopServer(int sig)
+{
+    stopping = 1;
+    shutdown(listenFd, SHUT_RDWR);
+}
+
+static int socketAddress(const char *socketPath, struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(addr->sun_path)) {
+        printf("socket path too long\n");
+        return 1;
+    }
+    strcpy(addr->sun_path, socketPath);
+    return 0;
+}
+
+int serve(const char *socketPath, int threads)
+{
+    struct sockaddr_un addr;
+    if (socketAddress(socketPath, &addr) != 0)
+        return 1;
+
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(socketPath);
+    if (listenFd < 0 || bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, SOMAXCONN) != 0) {
+        printf("cannot listen on %s\n", socketPath);
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = stopServer;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int status = 0, started = 0;
+    pthread_t *pool = malloc(sizeof(pthread_t) * threads);
+    if (pool != NULL)
+        for (int i = 0; i < threads; ++i)
+            if (pthread_create(pool + started, NULL, workerThread, NULL) == 0)
+                ++started;
+    if (started == 0) {
+        printf("cannot start the server threads\n");
+        status = 1;
+    }
+    for (int i = 0; i < started; ++i)
+        pthread_join(pool[i], NULL);
+
+    free(pool);
+    close(listenFd);
+    unlink(socketPath);
+    for (int i = 0; i < SERVER_CACHE_ENTRIES; ++i) {
+        free(cache[i].path);
+        free(cache[i].payload);
+    }
+    return status;
+}
+
+static char *readStdin(size_t *len)
+{
+    OutBuffer in;
+    if (initOutBuffer(&in, NULL, OUT_BUFFER_SIZE) != 0)
+        return NULL;
+    size_t n;
+    while ((n = fread(outReserve(&in, OUT_BUFFER_SIZE), 1, OUT_BUFFER_SIZE, stdin)) > 0)
+        in.len += n;
+    *len = in.len;
+    return in.data;
+}
+
+int requestServer(const char *socketPath, const char *path, int options,
+                  RenderFormat format, FILE *file)
+{
+    struct sockaddr_un addr;
+    if (socketAddress(socketPath, &addr) != 0)
+        return 1;
+
+    ServerRequest req = {SERVER_MAGIC, options, format, 0, 0};
+    char fullPath[PATH_MAX];
+    char *bytes = NULL;
+    size_t bytesLen = 0;
+
+    if (strcmp(path, "-") == 0) {
+        bytes = readStdin(&bytesLen);
+        if (bytes == NULL || bytesLen == 0 || bytesLen > SERVER_MAX_REQUEST) {
+            printf("no a.out on stdin\n");
+            free(bytes);
+            return 1;
+        }
+        req.bytesLen = bytesLen;
+    } else {
+        // the server does not share our working directory
+        if (realpath(path, fullPath) == NULL) {
+            printf("cannot open %s\n", path);
+            return 1;
+        }
+        req.pathLen = strlen(fullPath);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        printf("cannot connect to %s\n", socketPath);
+        if (fd >= 0)
+            close(fd);
+        free(bytes);
+        return 1;
+    }
+
+    int status = writeFull(fd, &req, sizeof(req));
+    if (status == 0)
+        status = bytes ? writeFull(fd, bytes, bytesLen) : writeFull(fd, fullPath, req.pathLen);
+    free(bytes);
+
+    uint32_t head[2];
+    if (status == 0 && readFull(fd, head, sizeof(head)) == 0) {
+        char buf[OUT_BUFFER_SIZE];
+        size_t left = head[1];
+        while (left > 0 && status == 0) {
+            size_t n = left < sizeof(buf) ? left : sizeof(buf);
+            status = readFull(fd, buf, n);
+            if (status == 0)
+                fwrite(buf, 1, n, file);
+            left -= n;
+        }
+        status |= head[0] != 0;
+    } else {
+        printf("no answer from %s\n", socketPath);
+        status = 1;
+    }
+
+    close(fd);
+    return status;
+}
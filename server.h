@@ -0,0 +1,72 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "render.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * --- SERVER ---
+ *
+ * dis --serve SOCKET stays up and disassembles for dis --client SOCKET
+ * over a Unix domain socket, one request per connection. A pool of threads
+ * accepts the connections, the rendered listings of files are cached by
+ * (path, inode, size, mtime, options, format).
+ *
+ * request
+ *   uint32_t magic      SERVER_MAGIC
+ *   uint32_t options    RENDER_ flags
+ *   uint32_t format     RenderFormat
+ *   uint32_t pathLen    length of the path, 0 for inline bytes
+ *   uint32_t bytesLen   length of the inline a.out, 0 for a path
+ *   char path[pathLen] or char bytes[bytesLen]
+ *
+ * response
+ *   uint32_t status     0 on success
+ *   uint32_t len
+ *   char payload[len]   the rendered listing, or an error message
+ *
+ * A text listing that fails ends with its error message, as on stdout;
+ * a json or record file that fails is replaced by the message.
+ */
+
+#define SERVER_MAGIC 0x51534944 // "DISQ"
+#define SERVER_MAX_REQUEST (16 << 20)
+#define SERVER_CACHE_ENTRIES 64
+#define SERVER_CACHE_MAX_PAYLOAD (4 << 20)
+#define SERVER_IO_TIMEOUT 10 // seconds a read or write of a connection may wait
+
+/**
+ * @brief A request, as sent on the socket
+ */
+typedef struct ServerRequestStruct {
+    uint32_t magic;
+    uint32_t options;
+    uint32_t format;
+    uint32_t pathLen;
+    uint32_t bytesLen;
+} ServerRequest;
+
+/**
+ * @brief Serve requests until SIGINT or SIGTERM
+ *
+ * @param socketPath const char* created, replaced if it exists
+ * @param threads int size of the pool, 0 for one per core
+ * @return int 0 on success, 1 on error
+ */
+int serve(const char *socketPath, int threads);
+
+/**
+ * @brief Send a request to a server and write the answer
+ *
+ * @param socketPath const char*
+ * @param path const char* a.out to disassemble, "-" for stdin sent inline
+ * @param options int RENDER_ flags
+ * @param format RenderFormat
+ * @param file FILE* where to write the listing
+ * @return int 0 on success, 1 on error
+ */
+int requestServer(const char *socketPath, const char *path, int options,
+                  RenderFormat format, FILE *file);
+
+#endif
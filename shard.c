@@ -0,0 +1,430 @@
+#include "shard.h"
+#include "disasembler.h"
+#include "image.h"
+#include "output.h"
+#include "pipeline.h"
+#include "render.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHARD_HOST_LEN 256
+
+static const char *const queueDirs[] = {"todo", "claimed", "done", "out"};
+
+/**
+ * @brief Totals of the summary lines of one host
+ */
+typedef struct ShardHostStruct {
+    char name[SHARD_HOST_LEN];
+    unsigned long files;
+    unsigned long long usec;
+} ShardHost;
+
+/**
+ * @brief The paths of one file as it goes through the queue
+ */
+typedef struct ShardPathsStruct {
+    char from[PATH_MAX];
+    char claimed[PATH_MAX];
+    char lease[PATH_MAX];
+    char lst[PATH_MAX];
+    char lstTmp[PATH_MAX];
+    char sum[PATH_MAX];
+    char sumTmp[PATH_MAX];
+    char done[PATH_MAX];
+} ShardPaths;
+
+/**
+ * @brief The lease file of a claim, touched while the file is processed
+ */
+typedef struct ShardLeaseStruct {
+    int fd;
+    int interval;
+    int done;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+} ShardLease;
+
+// snprintf, 1 if the result was cut to fit
+__attribute__((format(printf, 3, 4))) static int formatTo(char *dst, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(dst, size, fmt, args);
+    va_end(args);
+    return len < 0 || (size_t)len >= size;
+}
+
+// 1 if one of the paths is too long, the file is then left in todo
+static int makePaths(ShardPaths *paths, const char *queue, const char *name, const char *host)
+{
+    int pid = (int)getpid();
+    return formatTo(paths->from, sizeof(paths->from), "%s/todo/%s", queue, name) ||
+           formatTo(paths->claimed, sizeof(paths->claimed), "%s/claimed/%s@%s.%d", queue, name, host, pid) ||
+           formatTo(paths->lease, sizeof(paths->lease), "%s/claimed/.%s@%s.%d", queue, name, host, pid) ||
+           formatTo(paths->lst, sizeof(paths->lst), "%s/out/%s.lst", queue, name) ||
+           formatTo(paths->lstTmp, sizeof(paths->lstTmp), "%s.%s.%d", paths->lst, host, pid) ||
+           formatTo(paths->sum, sizeof(paths->sum), "%s/out/%s.sum", queue, name) ||
+           formatTo(paths->sumTmp, sizeof(paths->sumTmp), "%s.%s.%d", paths->sum, host, pid) ||
+           formatTo(paths->done, sizeof(paths->done), "%s/done/%s", queue, name);
+}
+
+static int makeQueue(const char *queue)
+{
+    char path[PATH_MAX];
+    if (mkdir(queue, 0777) != 0 && errno != EEXIST) {
+        printf("cannot create %s\n", queue);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(queueDirs) / sizeof(queueDirs[0]); ++i) {
+        if (formatTo(path, sizeof(path), "%s/%s", queue, queueDirs[i]) != 0) {
+            printf("path too long: %s\n", queue);
+            return 1;
+        }
+        if (mkdir(path, 0777) != 0 && errno != EEXIST) {
+            printf("cannot create %s\n", path);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// a claim of a worker that is gone : NAME@HOST.PID, its lease .NAME@HOST.PID
+static int staleClaim(const char *dir, const char *claim, const char *host, int lease, size_t *nameLen)
+{
+    const char *at = strrchr(claim, '@');
+    const char *dot = at ? strrchr(at, '.') : NULL;
+    if (dot == NULL)
+        return 0;
+    *nameLen = at - claim;
+
+    if ((size_t)(dot - at - 1) == strlen(host) && strncmp(at + 1, host, dot - at - 1) == 0) {
+        pid_t pid = atoi(dot + 1);
+        return pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+    }
+    char path[PATH_MAX];
+    struct stat st;
+    if (formatTo(path, sizeof(path), "%s/.%s", dir, claim) != 0 || stat(path, &st) != 0) {
+        // a lease is only removed once its claim is done
+        if (formatTo(path, sizeof(path), "%s/%s", dir, claim) != 0 || stat(path, &st) != 0)
+            return 0;
+    }
+    return time(NULL) - st.st_mtime > lease;
+}
+
+// a lease left by a worker gone between its claim going to done and the unlink
+static void removeOrphanLease(const char *dir, const char *name, int lease)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    if (formatTo(path, sizeof(path), "%s/%s", dir, name + 1) != 0 || stat(path, &st) == 0 || errno != ENOENT)
+        return;
+    if (formatTo(path, sizeof(path), "%s/%s", dir, name) == 0 && stat(path, &st) == 0 &&
+        time(NULL) - st.st_mtime > lease)
+        unlink(path);
+}
+
+static int requeueStale(const char *queue, const char *host, int lease)
+{
+    char dir[PATH_MAX], from[PATH_MAX], to[PATH_MAX];
+    DIR *d = formatTo(dir, sizeof(dir), "%s/claimed", queue) == 0 ? opendir(dir) : NULL;
+    if (d == NULL)
+        return 0;
+
+    int requeued = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t nameLen;
+        if (entry->d_name[0] == '.') {
+            if (entry->d_name[1] != '\0' && entry->d_name[1] != '.')
+                removeOrphanLease(dir, entry->d_name, lease);
+            continue;
+        }
+        if (!staleClaim(dir, entry->d_name, host, lease, &nameLen))
+            continue;
+        if (formatTo(from, sizeof(from), "%s/%s", dir, entry->d_name) != 0 ||
+            formatTo(to, sizeof(to), "%s/todo/%.*s", queue, (int)nameLen, entry->d_name) != 0)
+            continue;
+        // an other worker may requeue it first
+        if (rename(from, to) == 0) {
+            if (formatTo(from, sizeof(from), "%s/.%s", dir, entry->d_name) == 0)
+                unlink(from);
+            ++requeued;
+        }
+    }
+    closedir(d);
+    return requeued;
+}
+
+static void *refreshLease(void *arg)
+{
+    ShardLease *lease = arg;
+    pthread_mutex_lock(&lease->lock);
+    while (!lease->done) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += lease->interval;
+        if (pthread_cond_timedwait(&lease->cond, &lease->lock, &until) == ETIMEDOUT)
+            futimens(lease->fd, NULL);
+    }
+    pthread_mutex_unlock(&lease->lock);
+    return NULL;
+}
+
+// without the thread the claim still holds for one lease
+static void startLease(ShardLease *lease, int fd, int seconds)
+{
+    lease->fd = fd;
+    lease->interval = seconds / 3 > 0 ? seconds / 3 : 1;
+    lease->done = 0;
+    pthread_mutex_init(&lease->lock, NULL);
+    pthread_cond_init(&lease->cond, NULL);
+    lease->running = pthread_create(&lease->thread, NULL, refreshLease, lease) == 0;
+}
+
+static void stopLease(ShardLease *lease)
+{
+    if (lease->running) {
+        pthread_mutex_lock(&lease->lock);
+        lease->done = 1;
+        pthread_cond_signal(&lease->cond);
+        pthread_mutex_unlock(&lease->lock);
+        pthread_join(lease->thread, NULL);
+    }
+    pthread_cond_destroy(&lease->cond);
+    pthread_mutex_destroy(&lease->lock);
+}
+
+static int renderFile(FILE *file, Image *img, const ShardOptions *opts, ListingStats *stats)
+{
+    if (opts->pipelined && opts->format == FORMAT_TEXT && !(opts->options & RENDER_DATA))
+        return disassemblePipelined(file, img->text, img->textLen, stats);
+
+    OutBuffer out;
+    if (initOutBuffer(&out, file, OUT_BUFFER_SIZE) != 0)
+        return 1;
+    int status = renderImage(&out, img, opts->options, opts->format, stats);
+    status |= outFlush(&out);
+    freeOutBuffer(&out);
+    return status;
+}
+
+static int writeSummary(const char *path, const char *tmp, const char *line)
+{
+    FILE *file = fopen(tmp, "w");
+    if (file == NULL)
+        return 1;
+    int status = fputs(line, file) == EOF;
+    if (status | fclose(file) || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return 1;
+    }
+    return 0;
+}
+
+static void processFile(const ShardPaths *paths, const char *name, const char *host, const ShardOptions *opts)
+{
+    char line[PATH_MAX + 128];
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    const char *status = "ok";
+    ListingStats stats = {0, 0};
+    int textLen = 0;
+
+    Image img;
+    if (openImage(paths->claimed, &img) != 0) {
+        status = "bad image";
+    } else {
+        textLen = img.textLen;
+        FILE *file = fopen(paths->lstTmp, "w");
+        if (file == NULL) {
+            status = "cannot write";
+        } else {
+            // a listing cut by a zero length instruction is kept
+            if (renderFile(file, &img, opts, &stats) != 0)
+                status = "incomplete";
+            if (fclose(file) != 0 || rename(paths->lstTmp, paths->lst) != 0) {
+                unlink(paths->lstTmp);
+                status = "cannot write";
+            }
+        }
+        closeImage(&img);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    unsigned long long usec = (t1.tv_sec - t0.tv_sec) * 1000000ULL + (t1.tv_nsec - t0.tv_nsec) / 1000;
+
+    // without its summary the file stays claimed, and is redone
+    if (formatTo(line, sizeof(line), "%s\t%s\t%d\t%lu\t%lu\t%llu\t%s\n", name, status, textLen,
+                 stats.instructions, stats.undefined, usec, host) == 0 &&
+        writeSummary(paths->sum, paths->sumTmp, line) == 0)
+        rename(paths->claimed, paths->done);
+}
+
+static int worker(const char *queue, const char *host, const ShardOptions *opts)
+{
+    char todo[PATH_MAX];
+    ShardPaths paths;
+    if (formatTo(todo, sizeof(todo), "%s/todo", queue) != 0) {
+        printf("path too long: %s\n", queue);
+        return 1;
+    }
+
+    requeueStale(queue, host, opts->lease);
+    for (;;) {
+        DIR *d = opendir(todo);
+        if (d == NULL) {
+            printf("cannot open %s\n", todo);
+            return 1;
+        }
+        int claims = 0;
+        struct dirent *entry;
+        while ((entry = readdir(d)) != NULL) {
+            // dot files are being copied in
+            if (entry->d_name[0] == '.')
+                continue;
+            if (makePaths(&paths, queue, entry->d_name, host) != 0) {
+                printf("path too long for %s, skipped\n", entry->d_name);
+                continue;
+            }
+            // the lease is stamped before the claim shows, no other host sees a claim without it
+            int fd = open(paths.lease, O_WRONLY | O_CREAT | O_EXCL, 0666);
+            if (fd < 0)
+                continue;
+            if (rename(paths.from, paths.claimed) != 0) {
+                close(fd);
+                unlink(paths.lease);
+                continue;
+            }
+            ++claims;
+            ShardLease lease;
+            startLease(&lease, fd, opts->lease);
+            processFile(&paths, entry->d_name, host, opts);
+            stopLease(&lease);
+            close(fd);
+            // a file left claimed keeps its lease, for an other host to see it age
+            if (access(paths.claimed, F_OK) != 0)
+                unlink(paths.lease);
+        }
+        closedir(d);
+        if (claims == 0 && requeueStale(queue, host, opts->lease) == 0)
+            return 0;
+    }
+}
+
+int runShard(const char *queue, const ShardOptions *opts)
+{
+    char host[SHARD_HOST_LEN] = "localhost";
+    gethostname(host, sizeof(host) - 1);
+    if (makeQueue(queue) != 0)
+        return 1;
+
+    fflush(stdout);
+    int forked = 0;
+    for (int i = 1; i < opts->workers; ++i) {
+        pid_t pid = fork();
+        if (pid == 0)
+            exit(worker(queue, host, opts));
+        if (pid > 0)
+            ++forked;
+    }
+    int status = worker(queue, host, opts);
+    for (int i = 0; i < forked; ++i) {
+        int childStatus;
+        if (wait(&childStatus) > 0 && (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0))
+            status = 1;
+    }
+    return status;
+}
+
+/* --- SUMMARY --- */
+
+int mergeShardSummary(const char *queue, FILE *file)
+{
+    char dir[PATH_MAX], path[PATH_MAX], line[PATH_MAX + 128];
+    if (formatTo(dir, sizeof(dir), "%s/out", queue) != 0) {
+        printf("path too long: %s\n", queue);
+        return 1;
+    }
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        printf("cannot open %s\n", dir);
+        return 1;
+    }
+
+    ShardHost hosts[SHARD_MAX_HOSTS];
+    int numHosts = 0;
+    unsigned long files = 0, failed = 0, instructions = 0, undefined = 0;
+    unsigned long long bytes = 0, usec = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len < 4 || strcmp(entry->d_name + len - 4, ".sum") != 0)
+            continue;
+        if (formatTo(path, sizeof(path), "%s/%s", dir, entry->d_name) != 0) {
+            printf("path too long for %s, skipped\n", entry->d_name);
+            continue;
+        }
+        FILE *sum = fopen(path, "r");
+        if (sum == NULL)
+            continue;
+        char *fields[7] = {NULL};
+        if (fgets(line, sizeof(line), sum)) {
+            line[strcspn(line, "\n")] = '\0';
+            char *save = NULL;
+            for (int i = 0; i < 7; ++i)
+                fields[i] = strtok_r(i == 0 ? line : NULL, "\t", &save);
+        }
+        fclose(sum);
+        if (fields[6] == NULL)
+            continue;
+
+        ++files;
+        bytes += strtoull(fields[2], NULL, 10);
+        instructions += strtoul(fields[3], NULL, 10);
+        undefined += strtoul(fields[4], NULL, 10);
+        unsigned long long fileUsec = strtoull(fields[5], NULL, 10);
+        usec += fileUsec;
+        if (strcmp(fields[1], "ok") != 0) {
+            ++failed;
+            fprintf(file, "failed: %s: %s\n", fields[0], fields[1]);
+        }
+
+        int h = 0;
+        while (h < numHosts && strcmp(hosts[h].name, fields[6]) != 0)
+            ++h;
+        // a host past the table or with a name too long is only in the totals
+        if (h == numHosts && numHosts < SHARD_MAX_HOSTS &&
+            formatTo(hosts[h].name, SHARD_HOST_LEN, "%s", fields[6]) == 0) {
+            hosts[h].files = 0;
+            hosts[h].usec = 0;
+            ++numHosts;
+        }
+        if (h < numHosts) {
+            ++hosts[h].files;
+            hosts[h].usec += fileUsec;
+        }
+    }
+    closedir(d);
+
+    fprintf(file, "files: %lu (%lu ok, %lu failed)\n", files, files - failed, failed);
+    fprintf(file, "text: %llu bytes, %lu instructions, %lu undefined\n", bytes, instructions, undefined);
+    fprintf(file, "time: %.3f s of work, %.1f M instructions/s per worker\n", usec / 1e6,
+            usec ? (double)instructions / usec : 0.0);
+    for (int h = 0; h < numHosts; ++h)
+        fprintf(file, "host %s: %lu files, %.3f s\n", hosts[h].name, hosts[h].files, hosts[h].usec / 1e6);
+    return 0;
+}
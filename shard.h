@@ -0,0 +1,72 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdio.h>
+
+/*
+ * --- SHARD ---
+ *
+ * dis shard QUEUE disassembles an archive with any number of workers, on
+ * one host or on many sharing a filesystem, through a queue directory :
+ *   QUEUE/todo/NAME                executables to disassemble (or links)
+ *   QUEUE/claimed/NAME@HOST.PID    taken by a worker
+ *   QUEUE/claimed/.NAME@HOST.PID   its lease
+ *   QUEUE/done/NAME                finished
+ *   QUEUE/out/NAME.lst             the listing
+ *   QUEUE/out/NAME.sum             its summary line
+ *
+ * A worker claims a file by renaming it from todo to claimed, which only
+ * one of them can do. The lease file is created (O_EXCL) before, so its
+ * mtime is never older than the claim, and touched every third of the
+ * lease while the file is processed. Results are written to temporary
+ * files and renamed in place before the file is renamed to done, so a
+ * crash at any point leaves either a finished file or a claim. Claims of
+ * workers that are gone go back to todo when a worker starts or runs out
+ * of files : on the same host if the process no longer exists, from an
+ * other host once the lease file is older than the lease. Finished files
+ * are never redone.
+ *
+ * A summary line, tab separated :
+ *   NAME status textLen instructions undefined microseconds HOST
+ * status is "ok" or what failed, the instructions are those the listing
+ * went through. dis shard QUEUE --merge adds them up.
+ */
+
+#define SHARD_LEASE 600 // seconds before a claim of an other host is stale
+#define SHARD_MAX_HOSTS 64
+
+/**
+ * @brief How the files of a queue are disassembled
+ * @param format int RenderFormat
+ * @param options int RENDER_ flags
+ * @param pipelined int text listings with the pipeline
+ * @param workers int processes to run on this host
+ * @param lease int seconds
+ */
+typedef struct ShardOptionsStruct {
+    int format;
+    int options;
+    int pipelined;
+    int workers;
+    int lease;
+} ShardOptions;
+
+/**
+ * @brief Run workers until the queue is empty
+ *
+ * @param queue const char* the queue directory
+ * @param opts const ShardOptions*
+ * @return int 0 on success, 1 if the queue can not be used
+ */
+int runShard(const char *queue, const ShardOptions *opts);
+
+/**
+ * @brief Add up the summary lines of a queue
+ *
+ * @param queue const char*
+ * @param file FILE*
+ * @return int 0 on success, 1 on error
+ */
+int mergeShardSummary(const char *queue, FILE *file);
+
+#endif
@@ -0,0 +1,432 @@
+#include "signature.h"
+#include "disasembler.h"
+#include "symbols.h"
+#include "syntax.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SIG_LINE_LEN 256
+
+static const char hexDigits[] = "0123456789abcdef";
+
+/* --- PATTERNS --- */
+
+static void wildcard(Signature *sig, int from, int len)
+{
+    for (int i = from; i < from + len && i < sig->len; ++i) {
+        sig->mask[i] = 0;
+        sig->bytes[i] = 0;
+    }
+}
+
+int makeSignature(Image *img, unsigned int start, unsigned int end, Signature *sig)
+{
+    unsigned int limit = start + SIG_MAX_LEN;
+    if (limit > end)
+        limit = end;
+    if (limit > (unsigned int)img->textLen)
+        limit = img->textLen;
+
+    sig->len = 0;
+    unsigned int pos = start;
+    while (pos < limit) {
+        Instruction res = readInstruction(img->text, img->textLen, pos);
+        if (res.length == 0 || res.type == NULL)
+            break;
+        int n = res.length < limit - pos ? (int)res.length : (int)(limit - pos);
+        int at = sig->len;
+        memcpy(sig->bytes + at, img->text + pos, n);
+        memset(sig->mask + at, 0xff, n);
+        sig->len += n;
+
+        // the operands the linker relocates
+        Operand ops[MAX_OPERANDS];
+        int numOps = decodeOperands(pos, &res, ops);
+        for (int i = 0; i < numOps; ++i) {
+            int offset = ops[i].bytes - res.data;
+            if (ops[i].kind == OPERAND_TARGET || ops[i].kind == OPERAND_DIRECT || ops[i].kind == OPERAND_FAR)
+                wildcard(sig, at + offset, ops[i].len);
+            else if (ops[i].kind == OPERAND_MEM && modRMTable[(unsigned char)ops[i].bytes[0]].ea == EA_DIRECT)
+                wildcard(sig, at + offset + 1, 2);
+        }
+        pos += res.length;
+    }
+
+    while (sig->len > 0 && sig->mask[sig->len - 1] == 0)
+        --sig->len;
+    int fixed = 0, run = 0;
+    sig->anchor = sig->anchorLen = 0;
+    for (int i = 0; i < sig->len; ++i) {
+        run = sig->mask[i] ? run + 1 : 0;
+        fixed += sig->mask[i] != 0;
+        if (run > sig->anchorLen) {
+            sig->anchorLen = run;
+            sig->anchor = i + 1 - run;
+        }
+    }
+    return fixed < SIG_MIN_FIXED;
+}
+
+static int samePattern(const Signature *a, const Signature *b)
+{
+    return a->len == b->len && memcmp(a->bytes, b->bytes, a->len) == 0 && memcmp(a->mask, b->mask, a->len) == 0;
+}
+
+static int appendSignature(SignatureSet *set, const Signature *sig)
+{
+    if (set->count == set->capacity) {
+        unsigned int cap = set->capacity ? 2 * set->capacity : 64;
+        Signature *sigs = realloc(set->sigs, sizeof(Signature) * cap);
+        if (sigs == NULL)
+            return 1;
+        set->sigs = sigs;
+        set->capacity = cap;
+    }
+    set->sigs[set->count++] = *sig;
+    return 0;
+}
+
+int collectSignatures(Image *img, SignatureSet *set)
+{
+    int added = 0;
+    const Symbol *syms = img->syms.syms;
+    for (int i = 0; i < img->syms.count; ++i) {
+        if (syms[i].sect != N_TEXT || (i > 0 && syms[i - 1].sect == N_TEXT && syms[i - 1].value == syms[i].value))
+            continue;
+        // symbols are sorted by section then value
+        unsigned int end = img->textLen;
+        for (int j = i + 1; j < img->syms.count && syms[j].sect == N_TEXT; ++j) {
+            if (syms[j].value > syms[i].value) {
+                end = syms[j].value;
+                break;
+            }
+        }
+
+        Signature sig;
+        memset(&sig, 0, sizeof(Signature));
+        snprintf(sig.name, sizeof(sig.name), "%s", syms[i].name);
+        if (makeSignature(img, syms[i].value, end, &sig) != 0)
+            continue;
+        // the first name of a pattern is kept
+        unsigned int k = 0;
+        while (k < set->count && !samePattern(set->sigs + k, &sig))
+            ++k;
+        if (k < set->count)
+            continue;
+        if (appendSignature(set, &sig) != 0)
+            return -1;
+        ++added;
+    }
+    return added;
+}
+
+/* --- FILE --- */
+
+int writeSignatures(const char *path, SignatureSet *set)
+{
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+
+    int status = 0;
+    for (unsigned int i = 0; i < set->count; ++i) {
+        const Signature *sig = set->sigs + i;
+        char line[SIG_NAME_LEN + 3 * SIG_MAX_LEN + 2];
+        int len = sprintf(line, "%s\t", sig->name);
+        for (int j = 0; j < sig->len; ++j) {
+            line[len++] = sig->mask[j] ? hexDigits[sig->bytes[j] >> 4] : '?';
+            line[len++] = sig->mask[j] ? hexDigits[sig->bytes[j] & 0xf] : '?';
+            line[len++] = j + 1 < sig->len ? ' ' : '\n';
+        }
+        status |= fwrite(line, 1, len, file) != (size_t)len;
+    }
+
+    if (status | fclose(file)) {
+        printf("cannot write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+static int hexValue(char c)
+{
+    const char *digit = strchr(hexDigits, c | 0x20);
+    return c && digit ? digit - hexDigits : -1;
+}
+
+static int parseSignature(char *line, Signature *sig)
+{
+    memset(sig, 0, sizeof(Signature));
+    char *tab = strchr(line, '\t');
+    if (tab == NULL || tab == line || tab - line > SIG_NAME_LEN)
+        return 1;
+    memcpy(sig->name, line, tab - line);
+
+    for (char *p = tab + 1; *p && *p != '\n';) {
+        if (sig->len == SIG_MAX_LEN)
+            return 1;
+        if (p[0] == '?' && p[1] == '?') {
+            sig->mask[sig->len++] = 0;
+        } else if (hexValue(p[0]) >= 0 && hexValue(p[1]) >= 0) {
+            sig->bytes[sig->len] = hexValue(p[0]) << 4 | hexValue(p[1]);
+            sig->mask[sig->len++] = 0xff;
+        } else {
+            return 1;
+        }
+        p += 2;
+        while (*p == ' ')
+            ++p;
+    }
+
+    int run = 0;
+    for (int i = 0; i < sig->len; ++i) {
+        run = sig->mask[i] ? run + 1 : 0;
+        if (run > sig->anchorLen) {
+            sig->anchorLen = run;
+            sig->anchor = i + 1 - run;
+        }
+    }
+    return sig->anchorLen == 0;
+}
+
+int readSignatures(const char *path, SignatureSet *set)
+{
+    memset(set, 0, sizeof(SignatureSet));
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+
+    char line[SIG_LINE_LEN];
+    int status = 0;
+    for (int n = 1; status == 0 && fgets(line, sizeof(line), file); ++n) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        Signature sig;
+        if (parseSignature(line, &sig) != 0) {
+            printf("%s:%d: bad signature\n", path, n);
+            status = 1;
+        } else {
+            status = appendSignature(set, &sig);
+        }
+    }
+    fclose(file);
+
+    if (status == 0)
+        status = compileSignatures(set);
+    if (status != 0)
+        freeSignatures(set);
+    return status;
+}
+
+/* --- AUTOMATON --- */
+
+int compileSignatures(SignatureSet *set)
+{
+    unsigned int maxStates = 1;
+    for (unsigned int i = 0; i < set->count; ++i)
+        maxStates += set->sigs[i].anchorLen;
+
+    set->next = malloc(sizeof(uint32_t) * 256 * maxStates);
+    set->firstOut = malloc(sizeof(uint32_t) * maxStates);
+    set->dictLink = calloc(maxStates, sizeof(uint32_t));
+    set->nextOut = malloc(sizeof(uint32_t) * (set->count + 1));
+    uint32_t *fail = calloc(maxStates, sizeof(uint32_t));
+    uint32_t *queue = malloc(sizeof(uint32_t) * maxStates);
+    if (!set->next || !set->firstOut || !set->dictLink || !set->nextOut || !fail || !queue) {
+        free(fail);
+        free(queue);
+        return 1;
+    }
+    memset(set->next, 0xff, sizeof(uint32_t) * 256 * maxStates);
+    memset(set->firstOut, 0xff, sizeof(uint32_t) * maxStates);
+
+    // the trie of the anchors
+    set->numStates = 1;
+    for (unsigned int i = 0; i < set->count; ++i) {
+        const Signature *sig = set->sigs + i;
+        uint32_t state = 0;
+        for (int j = sig->anchor; j < sig->anchor + sig->anchorLen; ++j) {
+            uint32_t *edge = set->next + 256 * state + sig->bytes[j];
+            if (*edge == SIG_NONE)
+                *edge = set->numStates++;
+            state = *edge;
+        }
+        set->nextOut[i] = set->firstOut[state];
+        set->firstOut[state] = i;
+    }
+
+    // breadth first, every missing edge goes where the failure link goes
+    unsigned int head = 0, tail = 0;
+    for (int c = 0; c < 256; ++c) {
+        uint32_t *edge = set->next + c;
+        if (*edge == SIG_NONE)
+            *edge = 0;
+        else
+            queue[tail++] = *edge;
+    }
+    while (head < tail) {
+        uint32_t state = queue[head++];
+        for (int c = 0; c < 256; ++c) {
+            uint32_t *edge = set->next + 256 * state + c;
+            uint32_t onFail = set->next[256 * fail[state] + c];
+            if (*edge == SIG_NONE) {
+                *edge = onFail;
+                continue;
+            }
+            uint32_t child = *edge;
+            fail[child] = onFail;
+            set->dictLink[child] = set->firstOut[onFail] != SIG_NONE ? onFail : set->dictLink[onFail];
+            queue[tail++] = child;
+        }
+    }
+
+    free(fail);
+    free(queue);
+    return 0;
+}
+
+static int compareMatches(const void *a, const void *b)
+{
+    const SigMatch *x = a, *y = b;
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+    return x->sig < y->sig ? -1 : x->sig > y->sig;
+}
+
+static int verifySignature(const Signature *sig, const unsigned char *text, int textLen, long start)
+{
+    if (start < 0 || start + sig->len > textLen)
+        return 0;
+    for (int j = 0; j < sig->len; ++j)
+        if ((text[start + j] & sig->mask[j]) != sig->bytes[j])
+            return 0;
+    return 1;
+}
+
+int matchSignatures(SignatureSet *set, const char *text, int textLen, SigMatch **matches, unsigned int *count)
+{
+    const unsigned char *bytes = (const unsigned char *)text;
+    unsigned int capacity = 0;
+    *matches = NULL;
+    *count = 0;
+
+    uint32_t state = 0;
+    for (int i = 0; i < textLen; ++i) {
+        state = set->next[256 * state + bytes[i]];
+        for (uint32_t s = set->firstOut[state] != SIG_NONE ? state : set->dictLink[state]; s; s = set->dictLink[s]) {
+            for (uint32_t k = set->firstOut[s]; k != SIG_NONE; k = set->nextOut[k]) {
+                const Signature *sig = set->sigs + k;
+                long start = (long)i + 1 - sig->anchor - sig->anchorLen;
+                if (!verifySignature(sig, bytes, textLen, start))
+                    continue;
+                if (*count == capacity) {
+                    unsigned int cap = capacity ? 2 * capacity : 64;
+                    SigMatch *grown = realloc(*matches, sizeof(SigMatch) * cap);
+                    if (grown == NULL) {
+                        free(*matches);
+                        *matches = NULL;
+                        return 1;
+                    }
+                    *matches = grown;
+                    capacity = cap;
+                }
+                SigMatch m = {start, k};
+                (*matches)[(*count)++] = m;
+            }
+        }
+    }
+
+    if (*count == 0)
+        return 0;
+    qsort(*matches, *count, sizeof(SigMatch), compareMatches);
+    // the longest signature at an offset, the first in the file on a tie
+    unsigned int kept = 1;
+    SigMatch *m = *matches;
+    for (unsigned int i = 1; i < *count; ++i) {
+        if (m[i].offset != m[kept - 1].offset)
+            m[kept++] = m[i];
+        else if (set->sigs[m[i].sig].len > set->sigs[m[kept - 1].sig].len)
+            m[kept - 1] = m[i];
+    }
+    *count = kept;
+    return 0;
+}
+
+void freeSignatures(SignatureSet *set)
+{
+    free(set->sigs);
+    free(set->next);
+    free(set->firstOut);
+    free(set->nextOut);
+    free(set->dictLink);
+    memset(set, 0, sizeof(SignatureSet));
+}
+
+/* --- TOOLS --- */
+
+int buildSignatureFile(const char *path, char **files, int numFiles)
+{
+    SignatureSet set;
+    memset(&set, 0, sizeof(SignatureSet));
+    for (int i = 0; i < numFiles; ++i) {
+        Image img;
+        if (openImage(files[i], &img) != 0)
+            continue;
+        int added = collectSignatures(&img, &set);
+        closeImage(&img);
+        if (added < 0) {
+            freeSignatures(&set);
+            return 1;
+        }
+    }
+
+    int status = writeSignatures(path, &set);
+    if (status == 0)
+        printf("%u signatures\n", set.count);
+    freeSignatures(&set);
+    return status;
+}
+
+int disassembleSignatures(OutBuffer *out, Image *img, const char *sigPath)
+{
+    SignatureSet set;
+    if (readSignatures(sigPath, &set) != 0)
+        return 1;
+    SigMatch *matches;
+    unsigned int count, next = 0;
+    if (matchSignatures(&set, img->text, img->textLen, &matches, &count) != 0) {
+        freeSignatures(&set);
+        return 1;
+    }
+
+    int status = 0;
+    unsigned int pos = 0;
+    while (pos < (unsigned int)img->textLen) {
+        Instruction res = readInstruction(img->text, img->textLen, pos);
+        if (res.length == 0) {
+            outFlush(out);
+            printf("zero length instruction\n");
+            status = 1;
+            break;
+        }
+        // a match inside an instruction is not a routine
+        while (next < count && matches[next].offset < pos)
+            ++next;
+        if (next < count && matches[next].offset == pos) {
+            outStr(out, set.sigs[matches[next].sig].name);
+            outWrite(out, ":\n", 2);
+        }
+        formatInstruction(out, pos, &res);
+        outMaybeFlush(out);
+        pos += res.length;
+    }
+
+    free(matches);
+    freeSignatures(&set);
+    return status;
+}
@@ -0,0 +1,171 @@
+#ifndef SIGNATURE_H
+#define SIGNATURE_H
+
+#include "image.h"
+#include "output.h"
+#include <stdint.h>
+
+/*
+ * --- SIGNATURES ---
+ *
+ * Library routines linked into MINIX executables (printf, fopen, exit...)
+ * keep their code from one executable to the next; only the operands the
+ * linker relocates change. A signature is the first bytes of a text symbol
+ * with those operand bytes wildcarded, as the decoder finds them :
+ * relative targets ($P), addresses ($a and direct memory operands [0002])
+ * and far pointers ($o).
+ *
+ * dis sig build OUT FILE... writes the signatures of the text symbols of
+ * executables with symbols, one per line, ?? for a wildcard :
+ *   _printf<TAB>55 89 e5 56 e8 ?? ?? 8b 36 ?? ?? ...
+ * dis --sigs FILE EXE lists EXE with a NAME: line before each instruction
+ * starting a known routine.
+ *
+ * Matching is one pass over the text. The longest run of fixed bytes of
+ * each signature (its anchor) goes into an Aho-Corasick automaton, and
+ * each anchor found is checked against the whole masked signature.
+ */
+
+#define SIG_MAX_LEN 32
+#define SIG_MIN_FIXED 8 // fixed bytes for a routine to get a signature
+#define SIG_NAME_LEN 32
+#define SIG_NONE UINT32_MAX
+
+/**
+ * @brief A masked byte pattern
+ * @param name char[SIG_NAME_LEN + 1]
+ * @param len unsigned char
+ * @param bytes unsigned char[SIG_MAX_LEN]
+ * @param mask unsigned char[SIG_MAX_LEN] 0xff for a fixed byte, 0 for a
+ * wildcard
+ * @param anchor unsigned char offset of the longest run of fixed bytes
+ * @param anchorLen unsigned char
+ */
+typedef struct SignatureStruct {
+    char name[SIG_NAME_LEN + 1];
+    unsigned char len;
+    unsigned char bytes[SIG_MAX_LEN];
+    unsigned char mask[SIG_MAX_LEN];
+    unsigned char anchor;
+    unsigned char anchorLen;
+} Signature;
+
+/**
+ * @brief Signatures and the automaton over their anchors
+ * @param sigs Signature*
+ * @param count unsigned int
+ * @param capacity unsigned int
+ * @param next uint32_t* numStates x 256 transitions, state 0 is the root
+ * @param firstOut uint32_t* first signature whose anchor ends at a state
+ * @param nextOut uint32_t* next signature with the same anchor end state
+ * @param dictLink uint32_t* closest suffix state with outputs, 0 if none
+ * @param numStates unsigned int
+ */
+typedef struct SignatureSetStruct {
+    Signature *sigs;
+    unsigned int count;
+    unsigned int capacity;
+    uint32_t *next;
+    uint32_t *firstOut;
+    uint32_t *nextOut;
+    uint32_t *dictLink;
+    unsigned int numStates;
+} SignatureSet;
+
+/**
+ * @brief A signature found in a text
+ * @param offset unsigned int
+ * @param sig unsigned int index in the set
+ */
+typedef struct SigMatchStruct {
+    unsigned int offset;
+    unsigned int sig;
+} SigMatch;
+
+/**
+ * @brief Make the signature of the code in [start, end)
+ *
+ * @param img Image*
+ * @param start unsigned int
+ * @param end unsigned int
+ * @param sig Signature* name left as is
+ * @return int 0 on success, 1 if it has too few fixed bytes
+ */
+int makeSignature(Image *img, unsigned int start, unsigned int end, Signature *sig);
+
+/**
+ * @brief Add the signatures of the text symbols of an image, skipping the
+ * patterns already in the set
+ *
+ * @param img Image*
+ * @param set SignatureSet*
+ * @return int the number added, -1 on allocation failure
+ */
+int collectSignatures(Image *img, SignatureSet *set);
+
+/**
+ * @brief Write a signature file
+ *
+ * @param path const char*
+ * @param set SignatureSet*
+ * @return int 0 on success, 1 on error
+ */
+int writeSignatures(const char *path, SignatureSet *set);
+
+/**
+ * @brief Read a signature file and compile its automaton
+ *
+ * @param path const char*
+ * @param set SignatureSet* initialized here
+ * @return int 0 on success, 1 on error
+ */
+int readSignatures(const char *path, SignatureSet *set);
+
+/**
+ * @brief Build the automaton of the anchors
+ *
+ * @param set SignatureSet*
+ * @return int 0 on success, 1 on allocation failure
+ */
+int compileSignatures(SignatureSet *set);
+
+/**
+ * @brief Find the signatures in a text, one per offset (the longest)
+ *
+ * @param set SignatureSet* compiled
+ * @param text const char*
+ * @param textLen int
+ * @param matches SigMatch** allocated here, sorted by offset
+ * @param count unsigned int*
+ * @return int 0 on success, 1 on allocation failure
+ */
+int matchSignatures(SignatureSet *set, const char *text, int textLen, SigMatch **matches, unsigned int *count);
+
+/**
+ * @brief Free the signatures and the automaton
+ *
+ * @param set SignatureSet*
+ */
+void freeSignatures(SignatureSet *set);
+
+/**
+ * @brief dis sig build OUT FILE... : write the signatures of executables
+ *
+ * @param path const char* of the signature file
+ * @param files char** executables
+ * @param numFiles int
+ * @return int 0 on success, 1 on error
+ */
+int buildSignatureFile(const char *path, char **files, int numFiles);
+
+/**
+ * @brief Disassemble a text, labelling the routines a signature names
+ *
+ * @param out OutBuffer*
+ * @param img Image*
+ * @param sigPath const char*
+ * @return int 0 on success, 1 on error
+ */
+int disassembleSignatures(OutBuffer *out, Image *img, const char *sigPath);
+
+#endif
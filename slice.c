@@ -0,0 +1,233 @@
+#include "slice.h"
+#include "disasembler.h"
+#include "symbols.h"
+#include "syntax.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int appendSample(BoundaryIndex *idx, unsigned int *capacity, uint32_t offset, uint32_t listing)
+{
+    if (idx->count == *capacity) {
+        unsigned int cap = *capacity ? 2 * *capacity : 256;
+        IndexSample *samples = realloc(idx->samples, sizeof(IndexSample) * cap);
+        if (samples == NULL)
+            return 1;
+        idx->samples = samples;
+        *capacity = cap;
+    }
+    IndexSample s = {offset, listing};
+    idx->samples[idx->count++] = s;
+    return 0;
+}
+
+int buildIndex(Image *img, BoundaryIndex *idx)
+{
+    memset(idx, 0, sizeof(BoundaryIndex));
+    OutBuffer line;
+    if (initOutBuffer(&line, NULL, 256) != 0)
+        return 1;
+
+    unsigned int capacity = 0, n = 0, pos = 0;
+    uint32_t listing = 0;
+    int status = 0;
+    while (pos < img->textLen) {
+        if (n++ % SLICE_SAMPLE == 0 && (status = appendSample(idx, &capacity, pos, listing)) != 0)
+            break;
+        Instruction res = readInstruction(img->text, img->textLen, pos);
+        if (res.length == 0)
+            break;
+        // only the length of the line is kept
+        formatInstruction(&line, pos, &res);
+        listing += line.len;
+        line.len = 0;
+        pos += res.length;
+    }
+    idx->listingLen = listing;
+    idx->end = pos;
+
+    freeOutBuffer(&line);
+    if (status != 0)
+        freeIndex(idx);
+    return status;
+}
+
+void freeIndex(BoundaryIndex *idx)
+{
+    if (idx->map)
+        munmap(idx->map, idx->mapLen);
+    else
+        free(idx->samples);
+    memset(idx, 0, sizeof(BoundaryIndex));
+}
+
+int writeIndex(const char *path, BoundaryIndex *idx, int textLen, uint64_t hash, int syntax)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+
+    uint32_t head[3] = {INDEX_FILE_VERSION, textLen, idx->count};
+    uint32_t tail[3] = {idx->listingLen, idx->end, syntax};
+    int status = fwrite("DIDX", 1, 4, file) != 4 ||
+                 fwrite(head, sizeof(uint32_t), 3, file) != 3 ||
+                 fwrite(&hash, sizeof(uint64_t), 1, file) != 1 ||
+                 fwrite(tail, sizeof(uint32_t), 3, file) != 3 ||
+                 fwrite(idx->samples, sizeof(IndexSample), idx->count, file) != idx->count;
+
+    if (status | fclose(file)) {
+        printf("cannot write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int mapIndex(const char *path, BoundaryIndex *idx, int textLen, uint64_t hash, int syntax)
+{
+    memset(idx, 0, sizeof(BoundaryIndex));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < INDEX_HEADER_LEN) {
+        close(fd);
+        return 1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    uint32_t head[3], tail[3];
+    uint64_t fileHash;
+    memcpy(head, map + 4, sizeof(head));
+    memcpy(&fileHash, map + 16, sizeof(fileHash));
+    memcpy(tail, map + 24, sizeof(tail));
+    if (memcmp(map, "DIDX", 4) != 0 || head[0] != INDEX_FILE_VERSION || head[1] != (uint32_t)textLen ||
+        fileHash != hash || tail[2] != (uint32_t)syntax || st.st_size != INDEX_HEADER_LEN + (size_t)head[2] * sizeof(IndexSample)) {
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    idx->map = map;
+    idx->mapLen = st.st_size;
+    idx->count = head[2];
+    idx->listingLen = tail[0];
+    idx->end = tail[1];
+    idx->samples = (IndexSample *)(map + INDEX_HEADER_LEN);
+    return 0;
+}
+
+int loadIndex(const char *path, Image *img, BoundaryIndex *idx)
+{
+    size_t pathLen = strlen(path);
+    char *idxPath = malloc(pathLen + sizeof(".idx"));
+    if (idxPath == NULL)
+        return 1;
+    memcpy(idxPath, path, pathLen);
+    memcpy(idxPath + pathLen, ".idx", sizeof(".idx"));
+
+    // the listing offsets depend on the syntax, and a patch may keep the mtime
+    uint64_t hash = imageHash(img);
+    int syntax = getSyntax();
+    int status = 0;
+    if (mapIndex(idxPath, idx, img->textLen, hash, syntax) != 0) {
+        status = buildIndex(img, idx);
+        // a read only directory only costs the next run a rebuild
+        if (status == 0)
+            writeIndex(idxPath, idx, img->textLen, hash, syntax);
+    }
+    free(idxPath);
+    return status;
+}
+
+const IndexSample *findSample(BoundaryIndex *idx, unsigned int offset)
+{
+    unsigned int lo = 0, hi = idx->count;
+    // first sample after offset
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (idx->samples[mid].offset <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? idx->samples + lo - 1 : NULL;
+}
+
+int symbolRange(Image *img, const char *name, unsigned int *start, unsigned int *end)
+{
+    const Symbol *sym = findSymbolByName(&img->syms, name);
+    if (sym == NULL || sym->sect != N_TEXT) {
+        printf("no text symbol %s\n", name);
+        return 1;
+    }
+
+    *start = sym->value;
+    *end = img->textLen;
+    // symbols are sorted by section then value
+    const Symbol *last = img->syms.syms + img->syms.count;
+    for (const Symbol *next = sym + 1; next < last && next->sect == N_TEXT; ++next) {
+        if (next->value > sym->value) {
+            *end = next->value;
+            break;
+        }
+    }
+    return 0;
+}
+
+int disassembleSlice(OutBuffer *out, Image *img, BoundaryIndex *idx, unsigned int start, unsigned int end)
+{
+    const IndexSample *sample = findSample(idx, start);
+    if (sample == NULL)
+        return 0;
+
+    unsigned int pos = sample->offset;
+    if (end > (unsigned int)img->textLen)
+        end = img->textLen;
+    while (pos < end) {
+        Instruction res = readInstruction(img->text, img->textLen, pos);
+        if (res.length == 0) {
+            outFlush(out);
+            printf("zero length instruction\n");
+            return 1;
+        }
+        if (pos >= start) {
+            formatInstruction(out, pos, &res);
+            outMaybeFlush(out);
+        }
+        pos += res.length;
+    }
+    return 0;
+}
+
+long listingOffset(Image *img, BoundaryIndex *idx, unsigned int addr)
+{
+    const IndexSample *sample = findSample(idx, addr);
+    if (sample == NULL)
+        return idx->listingLen;
+
+    OutBuffer line;
+    if (initOutBuffer(&line, NULL, 256) != 0)
+        return -1;
+
+    unsigned int pos = sample->offset;
+    long listing = sample->listing;
+    while (pos < addr && pos < idx->end) {
+        Instruction res = readInstruction(img->text, img->textLen, pos);
+        formatInstruction(&line, pos, &res);
+        listing += line.len;
+        line.len = 0;
+        pos += res.length;
+    }
+
+    freeOutBuffer(&line);
+    return listing;
+}
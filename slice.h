@@ -0,0 +1,158 @@
+#ifndef SLICE_H
+#define SLICE_H
+
+#include "image.h"
+#include "output.h"
+#include <stdint.h>
+
+/*
+ * --- SLICES ---
+ *
+ * --start ADDR, --end ADDR and --symbol NAME list only a part of the text.
+ * A linear sweep only knows where instructions start by decoding from 0,
+ * so every SLICE_SAMPLE instructions the sweep is sampled into an index :
+ * the offset of that instruction and the offset of its line in the full
+ * text listing. A slice decodes from the last sample before it, a viewer
+ * finds the line of any address (dis seek FILE ADDR) the same way.
+ *
+ * --- INDEX FILE ---
+ *
+ * Written next to the executable as <file>.idx, mapped as is :
+ *   char magic[4]       "DIDX"
+ *   uint32_t version    INDEX_FILE_VERSION
+ *   uint32_t textLen
+ *   uint32_t count
+ *   uint64_t hash       imageHash of the executable
+ *   uint32_t listingLen length of the full listing
+ *   uint32_t end        where the sweep stopped, textLen if it did not
+ *   uint32_t syntax     of the listing the offsets are in
+ *   IndexSample samples[count]
+ * The file is stale if the hash or the syntax differs.
+ */
+
+#define SLICE_SAMPLE 64
+#define INDEX_FILE_VERSION 2
+#define INDEX_HEADER_LEN 36
+
+/**
+ * @brief One sampled instruction
+ * @param offset uint32_t in the text
+ * @param listing uint32_t offset of its line in the listing
+ */
+typedef struct IndexSampleStruct {
+    uint32_t offset;
+    uint32_t listing;
+} IndexSample;
+
+/**
+ * @brief The sampled instruction boundaries of a text, allocated or mapped
+ * @param samples IndexSample*
+ * @param count unsigned int
+ * @param listingLen uint32_t
+ * @param end uint32_t
+ * @param map char* the mapped file or NULL
+ * @param mapLen size_t
+ */
+typedef struct BoundaryIndexStruct {
+    IndexSample *samples;
+    unsigned int count;
+    uint32_t listingLen;
+    uint32_t end;
+    char *map;
+    size_t mapLen;
+} BoundaryIndex;
+
+/**
+ * @brief Sweep the text of an image to sample its boundaries
+ *
+ * @param img Image*
+ * @param idx BoundaryIndex* initialized here
+ * @return int 0 on success, 1 on allocation failure
+ */
+int buildIndex(Image *img, BoundaryIndex *idx);
+
+/**
+ * @brief Free an allocated or mapped index
+ *
+ * @param idx BoundaryIndex*
+ */
+void freeIndex(BoundaryIndex *idx);
+
+/**
+ * @brief Write an index file
+ *
+ * @param path const char*
+ * @param idx BoundaryIndex*
+ * @param textLen int
+ * @param hash uint64_t imageHash of the executable
+ * @param syntax int of the listing
+ * @return int 0 on success, 1 on error
+ */
+int writeIndex(const char *path, BoundaryIndex *idx, int textLen, uint64_t hash, int syntax);
+
+/**
+ * @brief Map an index file, silently failing if it is missing or stale
+ *
+ * @param path const char*
+ * @param idx BoundaryIndex* initialized here
+ * @param textLen int expected
+ * @param hash uint64_t expected
+ * @param syntax int expected
+ * @return int 0 on success, 1 if it has to be rebuilt
+ */
+int mapIndex(const char *path, BoundaryIndex *idx, int textLen, uint64_t hash, int syntax);
+
+/**
+ * @brief Map the index next to an executable, or build and write it
+ *
+ * @param path const char* of the executable
+ * @param img Image*
+ * @param idx BoundaryIndex* initialized here
+ * @return int 0 on success, 1 on error
+ */
+int loadIndex(const char *path, Image *img, BoundaryIndex *idx);
+
+/**
+ * @brief Find the last sample at or before an offset
+ *
+ * @param idx BoundaryIndex*
+ * @param offset unsigned int
+ * @return const IndexSample*
+ */
+const IndexSample *findSample(BoundaryIndex *idx, unsigned int offset);
+
+/**
+ * @brief Get the range of a text symbol, up to the next one
+ *
+ * @param img Image*
+ * @param name const char*
+ * @param start unsigned int*
+ * @param end unsigned int*
+ * @return int 0 on success, 1 if there is no such text symbol
+ */
+int symbolRange(Image *img, const char *name, unsigned int *start, unsigned int *end);
+
+/**
+ * @brief List the instructions starting in [start, end)
+ *
+ * @param out OutBuffer*
+ * @param img Image*
+ * @param idx BoundaryIndex*
+ * @param start unsigned int
+ * @param end unsigned int
+ * @return int 0 on success, 1 on error
+ */
+int disassembleSlice(OutBuffer *out, Image *img, BoundaryIndex *idx, unsigned int start, unsigned int end);
+
+/**
+ * @brief Offset in the full listing of the line of the first instruction
+ * starting at or after an address
+ *
+ * @param img Image*
+ * @param idx BoundaryIndex*
+ * @param addr unsigned int
+ * @return long the offset, the listing length if there is none
+ */
+long listingOffset(Image *img, BoundaryIndex *idx, unsigned int addr);
+
+#endif
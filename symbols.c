@@ -0,0 +1,81 @@
+#include "symbols.h"
+#include <stdlib.h>
+#include <string.h>
+
+static int compareSymbols(const void *a, const void *b)
+{
+    const Symbol *sa = a, *sb = b;
+    if (sa->sect != sb->sect)
+        return sa->sect - sb->sect;
+    if (sa->value != sb->value)
+        return sa->value < sb->value ? -1 : 1;
+    return strcmp(sa->name, sb->name);
+}
+
+int readSymbols(const char *bytes, int len, SymbolTable *table)
+{
+    int count = len > 0 ? len / SYMBOL_ENTRY_LEN : 0;
+    table->count = 0;
+    table->syms = malloc(sizeof(Symbol) * (count ? count : 1));
+    if (table->syms == NULL)
+        return 1;
+
+    for (int i = 0; i < count; ++i) {
+        const unsigned char *entry = (const unsigned char *)bytes + i * SYMBOL_ENTRY_LEN;
+        char sect = entry[12] & N_SECT;
+        if (sect == N_UNDF || entry[0] == '\0')
+            continue;
+
+        Symbol *sym = table->syms + table->count++;
+        memcpy(sym->name, entry, SYMBOL_NAME_LEN);
+        sym->name[SYMBOL_NAME_LEN] = '\0';
+        sym->value = entry[8] | entry[9] << 8 | entry[10] << 16 | (unsigned int)entry[11] << 24;
+        sym->sect = sect;
+    }
+
+    qsort(table->syms, table->count, sizeof(Symbol), compareSymbols);
+    return 0;
+}
+
+void freeSymbols(SymbolTable *table)
+{
+    free(table->syms);
+    table->syms = NULL;
+    table->count = 0;
+}
+
+const Symbol *findSymbolBefore(const SymbolTable *table, char sect, unsigned int value)
+{
+    int lo = 0, hi = table->count;
+    // first symbol after (sect, value)
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const Symbol *sym = table->syms + mid;
+        if (sym->sect < sect || (sym->sect == sect && sym->value <= value))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0 || table->syms[lo - 1].sect != sect)
+        return NULL;
+    // the first one of equal values, in name order
+    while (lo > 1 && table->syms[lo - 2].sect == sect &&
+           table->syms[lo - 2].value == table->syms[lo - 1].value)
+        --lo;
+    return table->syms + lo - 1;
+}
+
+const Symbol *findSymbolAt(const SymbolTable *table, char sect, unsigned int value)
+{
+    const Symbol *sym = findSymbolBefore(table, sect, value);
+    return (sym && sym->value == value) ? sym : NULL;
+}
+
+const Symbol *findSymbolByName(const SymbolTable *table, const char *name)
+{
+    for (int i = 0; i < table->count; ++i)
+        if (strncmp(table->syms[i].name, name, SYMBOL_NAME_LEN) == 0 &&
+            strlen(name) <= SYMBOL_NAME_LEN)
+            return table->syms + i;
+    return NULL;
+}
@@ -0,0 +1,93 @@
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include "header.h"
+
+/*
+ * --- SYMBOLS ---
+ *
+ * MINIX a.out symbol table, after the text and data segments,
+ * symslen bytes of 16 byte entries :
+ *
+ *   char n_name[8]          name, not terminated if 8 chars long
+ *   long n_value            value (4 bytes, little endian)
+ *   unsigned char n_sclass  section (low 3 bits) and storage class
+ *   unsigned char n_numaux
+ *   unsigned short n_type
+ */
+
+#define SYMBOL_ENTRY_LEN 16
+#define SYMBOL_NAME_LEN 8
+
+#define N_SECT 07 // section mask of n_sclass
+#define N_UNDF 00
+#define N_ABS 01
+#define N_TEXT 02
+#define N_DATA 03
+#define N_BSS 04
+#define N_COMM 05
+
+/**
+ * @brief A symbol
+ * @param name char[SYMBOL_NAME_LEN + 1]
+ * @param value unsigned int
+ * @param sect char N_TEXT, N_DATA, ...
+ */
+typedef struct SymbolStruct {
+    char name[SYMBOL_NAME_LEN + 1];
+    unsigned int value;
+    char sect;
+} Symbol;
+
+/**
+ * @brief The symbols of an image, sorted by section then value
+ * @param syms Symbol*
+ * @param count int
+ */
+typedef struct SymbolTableStruct {
+    Symbol *syms;
+    int count;
+} SymbolTable;
+
+/**
+ * @brief Parse and sort a symbol table
+ *
+ * @param bytes const char* the symslen bytes of the table
+ * @param len int
+ * @param table SymbolTable*
+ * @return int 0 on success, 1 on allocation failure
+ */
+int readSymbols(const char *bytes, int len, SymbolTable *table);
+
+void freeSymbols(SymbolTable *table);
+
+/**
+ * @brief Find the symbol at an exact value of a section
+ *
+ * @param table SymbolTable*
+ * @param sect char
+ * @param value unsigned int
+ * @return const Symbol* or NULL
+ */
+const Symbol *findSymbolAt(const SymbolTable *table, char sect, unsigned int value);
+
+/**
+ * @brief Find the last symbol of a section at or before a value
+ *
+ * @param table SymbolTable*
+ * @param sect char
+ * @param value unsigned int
+ * @return const Symbol* or NULL
+ */
+const Symbol *findSymbolBefore(const SymbolTable *table, char sect, unsigned int value);
+
+/**
+ * @brief Find a symbol by name
+ *
+ * @param table SymbolTable*
+ * @param name const char*
+ * @return const Symbol* or NULL
+ */
+const Symbol *findSymbolByName(const SymbolTable *table, const char *name);
+
+#endif
@@ -0,0 +1,590 @@
+#include "syntax.h"
+#include "disasembler.h"
+#include "hexfmt.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOT_TEXT_LEN 12
+#define MNEMONIC_LEN 16
+
+/**
+ * @brief An operand of a template : a field ($R), maybe after some text
+ * (a$w, short $P), or only text (dx, 03)
+ * @param field char 0 for only text
+ * @param part signed char code part the field is in, -1 if in the opcode
+ * @param text char[SLOT_TEXT_LEN]
+ */
+typedef struct OperandSlotStruct {
+    char field;
+    signed char part;
+    char text[SLOT_TEXT_LEN];
+} OperandSlot;
+
+/**
+ * @brief A printFormat compiled once
+ */
+typedef struct FormatPlanStruct {
+    char mnemonic[MNEMONIC_LEN];
+    unsigned char mnemonicLen;
+    unsigned char numOps;
+    OperandSlot slots[MAX_OPERANDS];
+    signed char swapR, swapRS; // slots exchanged when d = 1
+    unsigned char opcodeLen;   // bytes the opcode fields are in
+    FieldMask w, W, d, r, s, c, z, x;
+    char hasW;     // w or W exists
+    char isRD;     // the (R part is before the (D part
+    char far;      // intersegment call, jmp or ret
+    char indirect; // call or jmp through r/m
+    char string;   // string primitive, b / w suffix
+} FormatPlan;
+
+static FormatPlan plans[NUM_OF_INSTRUCT_TYPES];
+static pthread_once_t plansOnce = PTHREAD_ONCE_INIT;
+
+const char *const regNames[2][8] = {
+    {"al", "cl", "dl", "bl", "ah", "ch", "dh", "bh"},
+    {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"},
+};
+const char *const segNames[4] = {"es", "cs", "ss", "ds"};
+static const char *const syntaxNames[NUM_OF_SYNTAXES] = {"mmvm", "as86", "att"};
+
+FieldMask compileField(const InstructionType *type, char field)
+{
+    FieldMask m = {0, 0};
+    for (const char *a = type->codeFormat; *a && *a != '('; ++a) {
+        m.mask <<= 1;
+        m.div <<= 1;
+        if (*a == field) {
+            m.mask |= 1;
+            if (*(a + 1) != field)
+                m.div |= 1;
+        }
+    }
+    if (m.mask == 0 || m.div == 0)
+        m.mask = m.div = 0;
+    return m;
+}
+
+int opcodeLength(const InstructionType *type)
+{
+    int bits = 0;
+    for (const char *a = type->codeFormat; *a && *a != '('; ++a)
+        ++bits;
+    return bits / 8;
+}
+
+int farTransfer(const InstructionType *type)
+{
+    return strstr(type->codeFormat, "(o)") != NULL ||
+           strcmp(type->codeFormat, "11111111(R011)") == 0 ||
+           strcmp(type->codeFormat, "11111111(R101)") == 0 ||
+           strcmp(type->codeFormat, "11001011") == 0 ||
+           strcmp(type->codeFormat, "11001010(Dw)") == 0;
+}
+
+static void compilePlan(int t)
+{
+    const InstructionType *type = instructionTypes + t;
+    FormatPlan *plan = plans + t;
+    const char *parts[MAX_INSTRUCT_LEN + 1] = {NULL};
+    splitCodeFormatTo(type, parts);
+
+    plan->w = compileField(type, 'w');
+    plan->W = compileField(type, 'W');
+    plan->d = compileField(type, 'd');
+    plan->r = compileField(type, 'r');
+    plan->s = compileField(type, 's');
+    plan->c = compileField(type, 'c');
+    plan->z = compileField(type, 'z');
+    plan->x = compileField(type, 'x');
+    plan->opcodeLen = opcodeLength(type);
+    plan->hasW = plan->w.div || plan->W.div;
+
+    // "mnemonic op, op"
+    const char *p = type->printFormat;
+    const char *space = strchr(p, ' ');
+    plan->mnemonicLen = space ? space - p : strlen(p);
+    memcpy(plan->mnemonic, p, plan->mnemonicLen);
+    plan->swapR = plan->swapRS = -1;
+
+    int rPart = -1, dPart = -1;
+    for (int j = 0; parts[j]; ++j) {
+        if (parts[j][0] == '(' && parts[j][1] == 'R' && rPart < 0)
+            rPart = j;
+        if (parts[j][0] == '(' && parts[j][1] == 'D' && dPart < 0)
+            dPart = j;
+    }
+    plan->isRD = rPart >= 0 && rPart < dPart;
+
+    for (const char *op = space ? space + 1 : NULL; op && plan->numOps < MAX_OPERANDS;) {
+        const char *end = strstr(op, ", ");
+        size_t len = end ? (size_t)(end - op) : strlen(op);
+        OperandSlot *slot = plan->slots + plan->numOps;
+        const char *dollar = memchr(op, '$', len);
+        size_t textLen = dollar ? (size_t)(dollar - op) : len;
+        memcpy(slot->text, op, textLen);
+        slot->field = dollar ? dollar[1] : 0;
+        slot->part = -1;
+        for (int j = 0; parts[j] && slot->field; ++j) {
+            if (parts[j][0] != '(')
+                continue;
+            if (parts[j][1] == slot->field ||
+                ((slot->field == 'r' || slot->field == 's') && parts[j][1] == 'R' && parts[j][2] == slot->field)) {
+                slot->part = j;
+                break;
+            }
+        }
+        if (slot->field == 'R')
+            plan->swapR = plan->numOps;
+        if (slot->field == 'r' || slot->field == 's')
+            plan->swapRS = plan->numOps;
+        ++plan->numOps;
+        op = end ? end + 2 : NULL;
+    }
+    if (!plan->d.div)
+        plan->swapR = plan->swapRS = -1;
+
+    plan->far = farTransfer(type);
+    plan->indirect = (strncmp(type->printFormat, "call $R", 7) == 0 || strncmp(type->printFormat, "jmp $R", 6) == 0);
+    plan->string = strchr(type->printFormat, '$') == NULL && plan->w.div;
+}
+
+static void compilePlans(void)
+{
+    for (int t = 0; t < NUM_OF_INSTRUCT_TYPES; ++t)
+        compilePlan(t);
+}
+
+static unsigned int littleEndian(const unsigned char *bytes, int len)
+{
+    unsigned int value = 0;
+    for (int i = len - 1; i >= 0; --i)
+        value = value << 8 | bytes[i];
+    return value;
+}
+
+int decodeOperands(unsigned int pos, Instruction *instr, Operand *ops)
+{
+    pthread_once(&plansOnce, compilePlans);
+    const FormatPlan *plan = plans + (instr->type - instructionTypes);
+    const unsigned char *data = (const unsigned char *)instr->data;
+    int wide = fieldValue(plan->w, data, plan->opcodeLen) | fieldValue(plan->W, data, plan->opcodeLen);
+    int regWide = plan->hasW ? wide : 1;
+
+    for (int i = 0; i < plan->numOps; ++i) {
+        const OperandSlot *slot = plan->slots + i;
+        Operand *op = ops + i;
+        memset(op, 0, sizeof(Operand));
+        op->text = slot->text;
+        op->wide = wide;
+
+        unsigned int k = 0;
+        for (int j = 0; j < slot->part; ++j)
+            k += instr->partsLengths[j];
+        const unsigned char *field = data + k;
+        op->bytes = (const char *)field;
+        op->len = slot->part >= 0 ? instr->partsLengths[slot->part] : 0;
+
+        switch (slot->field) {
+        case 'R':
+            if (modRMTable[field[0]].ea == EA_REGISTER) {
+                op->kind = OPERAND_REG;
+                op->reg = modRMTable[field[0]].rm;
+            } else {
+                op->kind = OPERAND_MEM;
+            }
+            op->wide = regWide;
+            break;
+        case 'r':
+        case 's':
+            op->kind = slot->field == 'r' ? OPERAND_REG : OPERAND_SEG;
+            if (slot->part < 0)
+                op->reg = fieldValue(slot->field == 'r' ? plan->r : plan->s, data, plan->opcodeLen);
+            else
+                op->reg = (field[0] >> 3) & 0x7;
+            op->wide = regWide;
+            break;
+        case 'D':
+            op->kind = OPERAND_IMM;
+            op->value = littleEndian(field, op->len);
+            op->strip = plan->isRD && (!plan->W.div || (fieldValue(plan->W, data, plan->opcodeLen) & 0b10));
+            op->sext = plan->W.div && fieldValue(plan->W, data, plan->opcodeLen) == 0b11;
+            if (op->sext)
+                op->value = (uint16_t)(signed char)op->value;
+            break;
+        case 'P': {
+            int disp = op->len == 2 ? (int)littleEndian(field, 2) : (signed char)field[0];
+            op->kind = OPERAND_TARGET;
+            op->value = (pos + instr->length + disp) & 0xffff;
+            break;
+        }
+        case 'a':
+            op->kind = OPERAND_DIRECT;
+            op->value = littleEndian(field, op->len);
+            break;
+        case 'p':
+            op->kind = OPERAND_PORT;
+            op->value = field[0];
+            break;
+        case 'o':
+            op->kind = OPERAND_FAR;
+            op->value = littleEndian(field, op->len);
+            break;
+        case 'i':
+            op->kind = OPERAND_INT;
+            op->value = field[0];
+            break;
+        case 'c':
+            op->kind = OPERAND_COUNT;
+            op->value = fieldValue(plan->c, data, plan->opcodeLen);
+            break;
+        case 'w':
+            op->kind = OPERAND_ACC;
+            break;
+        default:
+            // template text, int 03 is a number
+            op->bytes = NULL;
+            op->len = 0;
+            if (slot->text[0] >= '0' && slot->text[0] <= '9') {
+                op->kind = OPERAND_INT;
+                op->value = strtoul(slot->text, NULL, 16);
+            } else {
+                op->kind = OPERAND_LITERAL;
+            }
+            break;
+        }
+    }
+
+    // the direction bit exchanges r/m and reg
+    if (plan->swapR >= 0 && plan->swapRS >= 0 && fieldValue(plan->d, data, plan->opcodeLen) == 1) {
+        Operand tmp = ops[plan->swapR];
+        ops[plan->swapR] = ops[plan->swapRS];
+        ops[plan->swapRS] = tmp;
+    }
+    return plan->numOps;
+}
+
+/* --- MMVM --- */
+
+static void mmvmOperand(OutBuffer *out, const Operand *op)
+{
+    outStr(out, op->text);
+    switch (op->kind) {
+    case OPERAND_REG:
+        // ax needs w = 1, an other register any w, as mmvm prints them
+        outWrite(out, regNames[op->reg == 0 ? op->wide == 1 : op->wide != 0][(int)op->reg], 2);
+        break;
+    case OPERAND_SEG:
+        outWrite(out, segNames[op->reg & 0x3], 2);
+        break;
+    case OPERAND_MEM:
+        out->len += formatEA(outReserve(out, EA_STR_LEN), op->bytes);
+        break;
+    case OPERAND_IMM: {
+        char *dst = outReserve(out, 2 * op->len);
+        hexEncodeRev(dst, (const unsigned char *)op->bytes, op->len);
+        int skip = 0;
+        if (op->strip)
+            while (skip < 2 * op->len - 1 && dst[skip] == '0')
+                ++skip;
+        memmove(dst, dst + skip, 2 * op->len - skip);
+        out->len += 2 * op->len - skip;
+        break;
+    }
+    case OPERAND_TARGET:
+        hexEncodeWord(outReserve(out, 4), op->value);
+        out->len += 4;
+        break;
+    case OPERAND_DIRECT:
+    case OPERAND_PORT:
+    case OPERAND_FAR:
+    case OPERAND_INT:
+        if (op->bytes)
+            outHex(out, op->bytes, op->len);
+        break;
+    case OPERAND_COUNT:
+        outChar(out, '1');
+        break;
+    case OPERAND_ACC:
+        outChar(out, op->wide == 0 ? 'l' : 'x');
+        break;
+    }
+}
+
+static void formatMmvm(OutBuffer *out, const FormatPlan *plan, const Operand *ops, int n)
+{
+    outWrite(out, plan->mnemonic, plan->mnemonicLen);
+    for (int i = 0; i < n; ++i) {
+        outWrite(out, i == 0 ? " " : ", ", i == 0 ? 1 : 2);
+        mmvmOperand(out, ops + i);
+    }
+}
+
+/* --- AS86 AND AT&T --- */
+
+static void outNumber(OutBuffer *out, unsigned int value)
+{
+    outWrite(out, "0x", 2);
+    out->len += hexEncodeTrimmed(outReserve(out, 8), value);
+}
+
+static void outSigned(OutBuffer *out, int value)
+{
+    if (value < 0) {
+        outChar(out, '-');
+        value = -value;
+    }
+    outNumber(out, value);
+}
+
+static int eaDisp(const Operand *op)
+{
+    const ModRM *modRM = modRMTable + (unsigned char)op->bytes[0];
+    const unsigned char *disp = (const unsigned char *)op->bytes + 1;
+    if (modRM->dispLen == 1)
+        return (signed char)disp[0];
+    if (modRM->dispLen == 2)
+        return disp[0] | disp[1] << 8;
+    return 0;
+}
+
+static int needsSize(const FormatPlan *plan, const Operand *ops, int n)
+{
+    int memory = 0;
+    for (int i = 0; i < n; ++i) {
+        if (ops[i].kind == OPERAND_REG || ops[i].kind == OPERAND_ACC || ops[i].kind == OPERAND_SEG)
+            return 0;
+        memory |= ops[i].kind == OPERAND_MEM || ops[i].kind == OPERAND_DIRECT;
+    }
+    return memory && plan->hasW;
+}
+
+// the 6 bit external opcode of esc, the x field and the reg field
+static void outEscape(OutBuffer *out, const FormatPlan *plan, const unsigned char *data)
+{
+    outNumber(out, fieldValue(plan->x, data, plan->opcodeLen) << 3 | (data[plan->opcodeLen] >> 3 & 0x7));
+}
+
+static void outMnemonic(OutBuffer *out, const FormatPlan *plan, const unsigned char *data, Syntax syntax)
+{
+    if (plan->z.div) {
+        outStr(out, fieldValue(plan->z, data, plan->opcodeLen) ? "rep" : "repnz");
+        return;
+    }
+    if (plan->far) {
+        if (syntax == SYNTAX_ATT)
+            outChar(out, 'l');
+        outWrite(out, plan->mnemonic, plan->mnemonicLen);
+        if (syntax == SYNTAX_AS86)
+            outChar(out, plan->mnemonic[0] == 'r' ? 'f' : 'i');
+        return;
+    }
+    outWrite(out, plan->mnemonic, plan->mnemonicLen);
+    if (plan->string)
+        outChar(out, fieldValue(plan->w, data, plan->opcodeLen) ? 'w' : 'b');
+}
+
+static void as86Operand(OutBuffer *out, const Operand *op, int sized)
+{
+    switch (op->kind) {
+    case OPERAND_REG:
+        outWrite(out, regNames[op->wide & 1][(int)op->reg], 2);
+        break;
+    case OPERAND_SEG:
+        outWrite(out, segNames[op->reg & 0x3], 2);
+        break;
+    case OPERAND_MEM: {
+        const ModRM *modRM = modRMTable + (unsigned char)op->bytes[0];
+        if (sized)
+            outStr(out, op->wide & 1 ? "word ptr " : "byte ptr ");
+        outChar(out, '[');
+        if (modRM->ea == EA_DIRECT) {
+            outNumber(out, eaDisp(op));
+        } else {
+            if (modRM->base != REG_NONE)
+                outWrite(out, regNames[1][(int)modRM->base], 2);
+            if (modRM->base != REG_NONE && modRM->index != REG_NONE)
+                outChar(out, '+');
+            if (modRM->index != REG_NONE)
+                outWrite(out, regNames[1][(int)modRM->index], 2);
+            if (modRM->dispLen) {
+                int disp = eaDisp(op);
+                if (disp >= 0)
+                    outChar(out, '+');
+                outSigned(out, disp);
+            }
+        }
+        outChar(out, ']');
+        break;
+    }
+    case OPERAND_DIRECT:
+        if (sized)
+            outStr(out, op->wide & 1 ? "word ptr " : "byte ptr ");
+        outChar(out, '[');
+        outNumber(out, op->value);
+        outChar(out, ']');
+        break;
+    case OPERAND_IMM:
+        outChar(out, '#');
+        outNumber(out, op->value);
+        break;
+    case OPERAND_TARGET:
+    case OPERAND_PORT:
+    case OPERAND_INT:
+        outNumber(out, op->value);
+        break;
+    case OPERAND_FAR:
+        outNumber(out, op->value & 0xffff);
+        outChar(out, ',');
+        outNumber(out, op->value >> 16);
+        break;
+    case OPERAND_COUNT:
+        outStr(out, op->value ? "cl" : "1");
+        break;
+    case OPERAND_ACC:
+        outWrite(out, op->wide & 1 ? "ax" : "al", 2);
+        break;
+    case OPERAND_LITERAL:
+        outStr(out, op->text);
+        break;
+    }
+}
+
+static void formatAs86(OutBuffer *out, const FormatPlan *plan, const Operand *ops, int n, const unsigned char *data)
+{
+    int sized = needsSize(plan, ops, n);
+    outMnemonic(out, plan, data, SYNTAX_AS86);
+    if (plan->x.div) {
+        outChar(out, ' ');
+        outEscape(out, plan, data);
+    }
+    for (int i = 0; i < n; ++i) {
+        outWrite(out, i == 0 && !plan->x.div ? " " : ", ", i == 0 && !plan->x.div ? 1 : 2);
+        as86Operand(out, ops + i, sized);
+    }
+}
+
+static void attOperand(OutBuffer *out, const Operand *op)
+{
+    switch (op->kind) {
+    case OPERAND_REG:
+        outChar(out, '%');
+        outWrite(out, regNames[op->wide & 1][(int)op->reg], 2);
+        break;
+    case OPERAND_SEG:
+        outChar(out, '%');
+        outWrite(out, segNames[op->reg & 0x3], 2);
+        break;
+    case OPERAND_MEM: {
+        const ModRM *modRM = modRMTable + (unsigned char)op->bytes[0];
+        if (modRM->ea == EA_DIRECT) {
+            outNumber(out, eaDisp(op));
+            break;
+        }
+        if (modRM->dispLen)
+            outSigned(out, eaDisp(op));
+        outChar(out, '(');
+        if (modRM->base != REG_NONE) {
+            outChar(out, '%');
+            outWrite(out, regNames[1][(int)modRM->base], 2);
+        }
+        if (modRM->index != REG_NONE) {
+            outWrite(out, modRM->base != REG_NONE ? ",%" : "%", modRM->base != REG_NONE ? 2 : 1);
+            outWrite(out, regNames[1][(int)modRM->index], 2);
+        }
+        outChar(out, ')');
+        break;
+    }
+    case OPERAND_DIRECT:
+    case OPERAND_TARGET:
+        outNumber(out, op->value);
+        break;
+    case OPERAND_IMM:
+        outChar(out, '$');
+        outNumber(out, op->value);
+        break;
+    case OPERAND_PORT:
+    case OPERAND_INT:
+        outChar(out, '$');
+        outNumber(out, op->value);
+        break;
+    case OPERAND_FAR:
+        outChar(out, '$');
+        outNumber(out, op->value >> 16);
+        outWrite(out, ", $", 3);
+        outNumber(out, op->value & 0xffff);
+        break;
+    case OPERAND_COUNT:
+        outStr(out, op->value ? "%cl" : "$1");
+        break;
+    case OPERAND_ACC:
+        outWrite(out, op->wide & 1 ? "%ax" : "%al", 3);
+        break;
+    case OPERAND_LITERAL:
+        outChar(out, '%');
+        outStr(out, op->text);
+        break;
+    }
+}
+
+static void formatAtt(OutBuffer *out, const FormatPlan *plan, const Operand *ops, int n, const unsigned char *data)
+{
+    outMnemonic(out, plan, data, SYNTAX_ATT);
+    if (needsSize(plan, ops, n)) {
+        int wide = fieldValue(plan->w, data, plan->opcodeLen) | fieldValue(plan->W, data, plan->opcodeLen);
+        outChar(out, wide & 1 ? 'w' : 'b');
+    }
+    if (plan->x.div) {
+        outWrite(out, " $", 2);
+        outEscape(out, plan, data);
+    }
+    // source first
+    for (int i = n - 1; i >= 0; --i) {
+        outWrite(out, i == n - 1 && !plan->x.div ? " " : ", ", i == n - 1 && !plan->x.div ? 1 : 2);
+        if (plan->indirect)
+            outChar(out, '*');
+        attOperand(out, ops + i);
+    }
+}
+
+static Syntax selected = SYNTAX_MMVM;
+
+int parseSyntax(const char *name)
+{
+    for (int i = 0; i < NUM_OF_SYNTAXES; ++i)
+        if (strcmp(name, syntaxNames[i]) == 0)
+            return i;
+    return -1;
+}
+
+void setSyntax(Syntax syntax)
+{
+    selected = syntax;
+}
+
+Syntax getSyntax(void)
+{
+    return selected;
+}
+
+void formatOperands(OutBuffer *out, unsigned int pos, Instruction *instr)
+{
+    Operand ops[MAX_OPERANDS];
+    int n = decodeOperands(pos, instr, ops);
+    const FormatPlan *plan = plans + (instr->type - instructionTypes);
+    const unsigned char *data = (const unsigned char *)instr->data;
+    switch (selected) {
+    case SYNTAX_AS86:
+        formatAs86(out, plan, ops, n, data);
+        break;
+    case SYNTAX_ATT:
+        formatAtt(out, plan, ops, n, data);
+        break;
+    default:
+        formatMmvm(out, plan, ops, n);
+        break;
+    }
+    outChar(out, '\n');
+}
@@ -0,0 +1,177 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include "instruction.h"
+#include "output.h"
+#include <stdint.h>
+
+/*
+ * --- SYNTAX ---
+ *
+ * The printFormat templates are compiled once into a mnemonic and operand
+ * slots (which field, which code part it is in, the masks of the opcode
+ * fields). A decoded instruction is turned into Operands from them, and a
+ * backend picked once per run writes the text :
+ *   mmvm : the templates as they always printed, "mov ax, [bx+si+2]"
+ *   as86 : "mov ax, [bx+si+0x2]", "mov bx, #0x10", "int 0x20"
+ *   att  : "mov 0x2(%bx,%si), %ax", "mov $0x10, %bx", "int $0x20"
+ *
+ * Numbers are hexadecimal in every syntax. In as86 and att, shifts by CL,
+ * far calls, jumps and returns, byte / word string primitives, the size
+ * of memory operands without a register and the external opcode of esc
+ * ("esc 0xb, [0x723f]") are spelled out.
+ */
+
+/// @brief Output syntax of the instruction text
+typedef enum SyntaxEnum {
+    SYNTAX_MMVM,
+    SYNTAX_AS86,
+    SYNTAX_ATT,
+    NUM_OF_SYNTAXES
+} Syntax;
+
+/// @brief What an operand is
+typedef enum OperandKindEnum {
+    OPERAND_REG,     // general register, from r/m, reg or the opcode
+    OPERAND_SEG,     // segment register
+    OPERAND_MEM,     // memory through a ModRM byte
+    OPERAND_DIRECT,  // memory at an address given alone ($a)
+    OPERAND_IMM,     // immediate data ($D)
+    OPERAND_TARGET,  // relative jump target ($P)
+    OPERAND_FAR,     // segment:offset ($o)
+    OPERAND_PORT,    // fixed port ($p)
+    OPERAND_INT,     // interrupt type ($i, int 03)
+    OPERAND_COUNT,   // shift count, 1 or CL ($c)
+    OPERAND_ACC,     // al / ax (a$w)
+    OPERAND_LITERAL, // text of the template, dx
+} OperandKind;
+
+#define MAX_OPERANDS 3
+
+/**
+ * @brief Where the bits of an opcode field are, as getField finds them
+ * @param mask uint16_t
+ * @param div uint16_t lowest bit of the field, 0 if there is no field
+ */
+typedef struct FieldMaskStruct {
+    uint16_t mask;
+    uint16_t div;
+} FieldMask;
+
+extern const char *const regNames[2][8]; // byte and word registers by number
+extern const char *const segNames[4];
+
+/**
+ * @brief Find an opcode field of a type once, for fieldValue
+ *
+ * @param type const InstructionType*
+ * @param field char 'w', 'W', 'd', 'r', 's', 'c', 'z' or 'x'
+ * @return FieldMask zero if the type has no such field
+ */
+FieldMask compileField(const InstructionType *type, char field);
+
+/**
+ * @brief Bytes of a type the opcode fields are in, before its first part
+ *
+ * @param type const InstructionType*
+ * @return int 1 or 2
+ */
+int opcodeLength(const InstructionType *type);
+
+/**
+ * @brief Read an opcode field of an instruction
+ *
+ * @param m FieldMask
+ * @param data const unsigned char* the instruction
+ * @param opcodeLen int
+ * @return int the field, 0 if there is none
+ */
+static inline int fieldValue(FieldMask m, const unsigned char *data, int opcodeLen)
+{
+    if (!m.div)
+        return 0;
+    unsigned int bits = data[0];
+    if (opcodeLen > 1)
+        bits = bits << 8 | data[1];
+    return (bits & m.mask) / m.div;
+}
+
+/**
+ * @brief A decoded operand
+ * @param kind char OperandKind
+ * @param reg char register or segment number
+ * @param wide char w | W as mmvm reads it, bit 0 is the operand size
+ * @param strip char immediate printed without its leading zeros (mmvm)
+ * @param sext char immediate is a sign extended byte
+ * @param len unsigned char length of the field in bytes
+ * @param bytes const char* the field in the instruction, the ModRM byte
+ * for OPERAND_MEM
+ * @param value unsigned int immediate (sign extended), target, address,
+ * port...
+ * @param text const char* template text : literal or prefix ("short ")
+ */
+typedef struct OperandStruct {
+    char kind;
+    char reg;
+    char wide;
+    char strip;
+    char sext;
+    unsigned char len;
+    const char *bytes;
+    unsigned int value;
+    const char *text;
+} Operand;
+
+/**
+ * @brief Parse a syntax name, "mmvm", "as86" or "att"
+ *
+ * @param name const char*
+ * @return int the Syntax, -1 if unknown
+ */
+int parseSyntax(const char *name);
+
+/**
+ * @brief Select the syntax of every following formatInstruction, to be
+ * called before any thread formats
+ *
+ * @param syntax Syntax
+ */
+void setSyntax(Syntax syntax);
+
+/**
+ * @brief The syntax selected by setSyntax
+ *
+ * @return Syntax
+ */
+Syntax getSyntax(void);
+
+/**
+ * @brief Whether a type is an intersegment call, jump or return, which
+ * share their mnemonic with the near ones in the templates
+ *
+ * @param type const InstructionType*
+ * @return int 1 if it is
+ */
+int farTransfer(const InstructionType *type);
+
+/**
+ * @brief Decode the operands of an instruction, in printing order
+ *
+ * @param pos unsigned int of the instruction, for relative targets
+ * @param instr Instruction* with its partsLengths
+ * @param ops Operand* MAX_OPERANDS
+ * @return int the number of operands
+ */
+int decodeOperands(unsigned int pos, Instruction *instr, Operand *ops);
+
+/**
+ * @brief Write the text of an instruction and a newline in the selected
+ * syntax
+ *
+ * @param out OutBuffer*
+ * @param pos unsigned int
+ * @param instr Instruction* of a known type
+ */
+void formatOperands(OutBuffer *out, unsigned int pos, Instruction *instr);
+
+#endif
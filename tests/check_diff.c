@@ -0,0 +1,115 @@
+#include "diff.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * make check : diffSequences on sequences of equal and very unequal
+ * lengths. The kept elements must pair up in order, and below
+ * DIFF_MAX_COST the script must be as short as the longest common
+ * subsequence allows.
+ */
+
+static int failures = 0;
+
+// the number of edits, -1 if the kept elements do not pair up
+static int checkScript(const uint64_t *a, int n, const uint64_t *b, int m, const char *changedA,
+                       const char *changedB)
+{
+    int i = 0, j = 0, edits = 0;
+    while (i < n || j < m) {
+        if (i < n && changedA[i]) {
+            ++i, ++edits;
+        } else if (j < m && changedB[j]) {
+            ++j, ++edits;
+        } else if (i < n && j < m && a[i] == b[j]) {
+            ++i, ++j;
+        } else {
+            return -1;
+        }
+    }
+    return edits;
+}
+
+static int lcsLength(const uint64_t *a, int n, const uint64_t *b, int m)
+{
+    int *row = calloc(m + 1, sizeof(int));
+    for (int i = 1; i <= n; ++i) {
+        int diag = 0;
+        for (int j = 1; j <= m; ++j) {
+            int up = row[j];
+            row[j] = a[i - 1] == b[j - 1] ? diag + 1 : (row[j] > row[j - 1] ? row[j] : row[j - 1]);
+            diag = up;
+        }
+    }
+    int len = row[m];
+    free(row);
+    return len;
+}
+
+static void check(const char *name, const uint64_t *a, int n, const uint64_t *b, int m, int minimal)
+{
+    char *changedA = malloc(n + 1), *changedB = malloc(m + 1);
+    if (diffSequences(a, n, b, m, changedA, changedB) != 0) {
+        printf("%s: allocation failure\n", name);
+        ++failures;
+    } else {
+        int edits = checkScript(a, n, b, m, changedA, changedB);
+        int best = minimal ? n + m - 2 * lcsLength(a, n, b, m) : edits;
+        if (edits < 0 || edits != best) {
+            printf("%s: n %d m %d, %d edits for %d\n", name, n, m, edits, best);
+            ++failures;
+        }
+    }
+    free(changedA);
+    free(changedB);
+}
+
+static void fill(uint64_t *seq, int len, int alphabet)
+{
+    for (int i = 0; i < len; ++i)
+        seq[i] = rand() % alphabet;
+}
+
+int main(void)
+{
+    static uint64_t a[10000], b[10000];
+    srand(1);
+
+    // random, the lengths from equal to 1 : 60 either way
+    for (int trial = 0; trial < 400; ++trial) {
+        int n = 1 + rand() % 120, m = 1 + rand() % 120;
+        if (trial % 4 == 1)
+            n = 1 + rand() % 4;
+        if (trial % 4 == 2)
+            m = 1 + rand() % 4;
+        fill(a, n, 2 + trial % 6);
+        fill(b, m, 2 + trial % 6);
+        check("random", a, n, b, m, 1);
+    }
+
+    // a few instructions against a whole program, as t1.out and g0.out
+    for (int i = 0; i < 9480; ++i)
+        b[i] = 1000 + i;
+    for (int i = 0; i < 141; ++i)
+        a[i] = b[i * 67];
+    check("short old", a, 141, b, 9480, 0);
+    check("short new", b, 9480, a, 141, 0);
+
+    // under DIFF_MAX_COST the script is minimal
+    for (int i = 0; i < 30; ++i)
+        a[i] = b[i * 100];
+    check("skewed", a, 30, b, 3000, 1);
+    check("skewed back", b, 3000, a, 30, 1);
+
+    // nothing in common
+    fill(a, 50, 4);
+    for (int i = 0; i < 5000; ++i)
+        b[i] = 10 + i % 7;
+    check("disjoint", a, 50, b, 5000, 1);
+    check("disjoint back", b, 5000, a, 50, 1);
+
+    if (failures == 0)
+        printf("diff: ok\n");
+    return failures != 0;
+}
@@ -0,0 +1,300 @@
+#include "xref.h"
+#include "disasembler.h"
+#include "output.h"
+#include "symbols.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *xrefKindNames[] = {"call", "jump", "far", "mem", "imm"};
+
+static int appendXref(XrefTable *xrefs, unsigned int from, unsigned int length, unsigned int to, int kind)
+{
+    if (xrefs->count == xrefs->capacity) {
+        unsigned int capacity = xrefs->capacity ? 2 * xrefs->capacity : 1024;
+        Xref *byFrom = realloc(xrefs->byFrom, sizeof(Xref) * capacity);
+        if (byFrom == NULL)
+            return 1;
+        xrefs->byFrom = byFrom;
+        xrefs->capacity = capacity;
+    }
+    Xref x = {from, to & 0xffff, kind, length};
+    xrefs->byFrom[xrefs->count++] = x;
+    return 0;
+}
+
+static int compareByFrom(const void *a, const void *b)
+{
+    const Xref *x = a, *y = b;
+    if (x->from != y->from)
+        return x->from - y->from;
+    if (x->to != y->to)
+        return x->to - y->to;
+    return x->kind - y->kind;
+}
+
+static int compareByTo(const void *a, const void *b)
+{
+    const Xref *x = a, *y = b;
+    if (x->to != y->to)
+        return x->to - y->to;
+    if (x->from != y->from)
+        return x->from - y->from;
+    return x->kind - y->kind;
+}
+
+int collectXrefs(Image *img, DecodedText *dec, XrefTable *xrefs)
+{
+    memset(xrefs, 0, sizeof(XrefTable));
+    unsigned int dataEnd = img->dataBase + img->dataLen + img->hdr.bsslen;
+    int status = 0;
+
+    for (unsigned int i = 0; i < dec->count && status == 0; ++i) {
+        if (dec->typeIds[i] == RECORD_UNDEFINED)
+            continue;
+
+        Record rec = getRecord(dec, i);
+        const InstructionType *type = instructionTypes + rec.typeId;
+        const unsigned char *bytes = (unsigned char *)img->text + rec.offset;
+        unsigned int target;
+
+        // relative target, jump, call or loop $P
+        if (recordTarget(&rec, img->text, &target) > 0) {
+            int kind = strncmp(type->printFormat, "call ", 5) == 0 ? XREF_CALL : XREF_JUMP;
+            status |= appendXref(xrefs, rec.offset, rec.length, target, kind);
+        }
+        // call $o / jmp $o, offset then segment
+        if (strstr(type->codeFormat, "(o)") != NULL)
+            status |= appendXref(xrefs, rec.offset, rec.length, bytes[1] | bytes[2] << 8, XREF_FAR);
+        // [disp] direct memory operand
+        if (OPERANDS_HAS_MODRM(rec.operands) && OPERANDS_MOD(rec.operands) == 0b00 &&
+            OPERANDS_RM(rec.operands) == 0b110)
+            status |= appendXref(xrefs, rec.offset, rec.length, bytes[2] | bytes[3] << 8, XREF_MEM);
+        // mov a$w, $a / mov $a, a$w
+        if (strstr(type->codeFormat, "(a)") != NULL)
+            status |= appendXref(xrefs, rec.offset, rec.length, bytes[1] | bytes[2] << 8, XREF_MEM);
+        // mov $r, #message : word immediate, the last 2 bytes
+        if (strncmp(type->printFormat, "mov ", 4) == 0 &&
+            strstr(type->codeFormat, "(D)") != NULL && OPERANDS_W(rec.operands)) {
+            unsigned int value = bytes[rec.length - 2] | bytes[rec.length - 1] << 8;
+            if (value >= img->dataBase && value < dataEnd)
+                status |= appendXref(xrefs, rec.offset, rec.length, value, XREF_IMM);
+        }
+    }
+
+    if (status == 0 && xrefs->count > 0) {
+        xrefs->byTo = malloc(sizeof(Xref) * xrefs->count);
+        if (xrefs->byTo == NULL) {
+            status = 1;
+        } else {
+            // collected by from, in the order of the checks above
+            qsort(xrefs->byFrom, xrefs->count, sizeof(Xref), compareByFrom);
+            memcpy(xrefs->byTo, xrefs->byFrom, sizeof(Xref) * xrefs->count);
+            qsort(xrefs->byTo, xrefs->count, sizeof(Xref), compareByTo);
+        }
+    }
+    if (status != 0)
+        freeXrefs(xrefs);
+    return status;
+}
+
+int buildXrefs(Image *img, XrefTable *xrefs)
+{
+    DecodedText dec;
+    if (initDecodedText(&dec, img->textLen / 3) != 0)
+        return 1;
+
+    int status = decodeText(img->text, img->textLen, &dec);
+    if (status == 0)
+        status = collectXrefs(img, &dec, xrefs);
+    freeDecodedText(&dec);
+    return status;
+}
+
+void freeXrefs(XrefTable *xrefs)
+{
+    if (xrefs->map) {
+        munmap(xrefs->map, xrefs->mapLen);
+    } else {
+        free(xrefs->byFrom);
+        free(xrefs->byTo);
+    }
+    memset(xrefs, 0, sizeof(XrefTable));
+}
+
+int writeXrefs(const char *path, XrefTable *xrefs, int textLen, uint64_t hash)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        printf("cannot open %s\n", path);
+        return 1;
+    }
+
+    uint32_t head[3] = {XREF_FILE_VERSION, textLen, xrefs->count};
+    int status = fwrite("DXRF", 1, 4, file) != 4 ||
+                 fwrite(head, sizeof(uint32_t), 3, file) != 3 ||
+                 fwrite(&hash, sizeof(uint64_t), 1, file) != 1 ||
+                 fwrite(xrefs->byFrom, sizeof(Xref), xrefs->count, file) != xrefs->count ||
+                 fwrite(xrefs->byTo, sizeof(Xref), xrefs->count, file) != xrefs->count;
+
+    if (status | fclose(file)) {
+        printf("cannot write %s\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+int mapXrefs(const char *path, XrefTable *xrefs, int textLen, uint64_t hash)
+{
+    memset(xrefs, 0, sizeof(XrefTable));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return 1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < XREF_HEADER_LEN) {
+        close(fd);
+        return 1;
+    }
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return 1;
+
+    uint32_t head[3];
+    uint64_t fileHash;
+    memcpy(head, map + 4, sizeof(head));
+    memcpy(&fileHash, map + 16, sizeof(fileHash));
+    if (memcmp(map, "DXRF", 4) != 0 || head[0] != XREF_FILE_VERSION || head[1] != (uint32_t)textLen ||
+        fileHash != hash || st.st_size != XREF_HEADER_LEN + 2 * (size_t)head[2] * sizeof(Xref)) {
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    xrefs->map = map;
+    xrefs->mapLen = st.st_size;
+    xrefs->count = head[2];
+    xrefs->byFrom = (Xref *)(map + XREF_HEADER_LEN);
+    xrefs->byTo = xrefs->byFrom + xrefs->count;
+    return 0;
+}
+
+const Xref *findXrefsTo(XrefTable *xrefs, unsigned int to, unsigned int *count)
+{
+    unsigned int lo = 0, hi = xrefs->count;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (xrefs->byTo[mid].to < to)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    unsigned int end = lo;
+    while (end < xrefs->count && xrefs->byTo[end].to == to)
+        ++end;
+    *count = end - lo;
+    return xrefs->byTo + lo;
+}
+
+const Xref *findXrefsFrom(XrefTable *xrefs, unsigned int from, unsigned int *count)
+{
+    unsigned int lo = 0, hi = xrefs->count;
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (xrefs->byFrom[mid].from < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    unsigned int end = lo;
+    while (end < xrefs->count && xrefs->byFrom[end].from == from)
+        ++end;
+    *count = end - lo;
+    return xrefs->byFrom + lo;
+}
+
+/**
+ * @brief Resolve ADDR|SYMBOL, a symbol restricts the kinds of references
+ *
+ * @return int 0 on success, 1 if unknown
+ */
+static int resolveQuery(Image *img, const char *query, unsigned int *addr, int *code)
+{
+    const Symbol *sym = findSymbolByName(&img->syms, query);
+    if (sym) {
+        *addr = sym->value;
+        *code = sym->sect == N_TEXT;
+        return 0;
+    }
+
+    char *end;
+    unsigned long value = strtoul(query, &end, 16);
+    if (*query == '\0' || *end != '\0' || value > 0xffff) {
+        printf("unknown symbol %s\n", query);
+        return 1;
+    }
+    *addr = value;
+    *code = -1;
+    return 0;
+}
+
+int queryXrefs(const char *path, const char *query, FILE *file)
+{
+    Image img;
+    if (openImage(path, &img) != 0)
+        return 1;
+
+    unsigned int addr;
+    int code;
+    if (resolveQuery(&img, query, &addr, &code) != 0) {
+        closeImage(&img);
+        return 1;
+    }
+
+    size_t pathLen = strlen(path);
+    char *xrefPath = malloc(pathLen + sizeof(".xref"));
+    if (xrefPath == NULL) {
+        closeImage(&img);
+        return 1;
+    }
+    memcpy(xrefPath, path, pathLen);
+    memcpy(xrefPath + pathLen, ".xref", sizeof(".xref"));
+
+    // a patch may keep the mtime
+    uint64_t hash = imageHash(&img);
+    XrefTable xrefs;
+    int status = 0;
+    if (mapXrefs(xrefPath, &xrefs, img.textLen, hash) != 0) {
+        status = buildXrefs(&img, &xrefs);
+        // a read only directory only costs the next query a rebuild
+        if (status == 0)
+            writeXrefs(xrefPath, &xrefs, img.textLen, hash);
+    }
+    free(xrefPath);
+
+    OutBuffer out;
+    if (status == 0 && initOutBuffer(&out, file, OUT_BUFFER_SIZE) == 0) {
+        unsigned int count;
+        const Xref *x = findXrefsTo(&xrefs, addr, &count);
+        for (unsigned int i = 0; i < count; ++i) {
+            if (code >= 0 && XREF_IS_CODE(x[i].kind) != code)
+                continue;
+            outStr(&out, xrefKindNames[x[i].kind]);
+            outWrite(&out, "     ", 5 - strlen(xrefKindNames[x[i].kind]));
+            Instruction instr = readInstruction(img.text, img.textLen, x[i].from);
+            formatInstruction(&out, x[i].from, &instr);
+            outMaybeFlush(&out);
+        }
+        freeOutBuffer(&out);
+        freeXrefs(&xrefs);
+    } else if (status == 0) {
+        freeXrefs(&xrefs);
+        status = 1;
+    }
+
+    closeImage(&img);
+    return status;
+}
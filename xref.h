@@ -0,0 +1,157 @@
+#ifndef XREF_H
+#define XREF_H
+
+#include "image.h"
+#include "records.h"
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * --- CROSS REFERENCES ---
+ *
+ * Every address an instruction references :
+ *   XREF_CALL, XREF_JUMP : relative targets ($P) of calls, jumps and loops
+ *   XREF_FAR             : offset of a far call or jump ($o), the segment
+ *                          is not kept
+ *   XREF_MEM             : direct memory operands, [disp] and mov a$w, $a
+ *   XREF_IMM             : mov $r, #message word immediates that point in
+ *                          the data or bss segment
+ * kept twice, sorted by referencing instruction (from) and by referenced
+ * address (to), so both questions are a binary search.
+ *
+ * --- XREF FILE ---
+ *
+ * Written next to the executable as <file>.xref, mapped as is :
+ *   char magic[4]       "DXRF"
+ *   uint32_t version    XREF_FILE_VERSION
+ *   uint32_t textLen
+ *   uint32_t count
+ *   uint64_t hash       imageHash of the executable, the file is stale if
+ *                       it differs
+ *   Xref byFrom[count]
+ *   Xref byTo[count]
+ */
+
+#define XREF_FILE_VERSION 2
+#define XREF_HEADER_LEN 24
+
+#define XREF_CALL 0
+#define XREF_JUMP 1
+#define XREF_FAR 2
+#define XREF_MEM 3
+#define XREF_IMM 4
+
+#define XREF_IS_CODE(kind) ((kind) <= XREF_FAR)
+
+/**
+ * @brief One reference
+ * @param from uint16_t offset of the referencing instruction
+ * @param to uint16_t referenced address
+ * @param kind uint8_t XREF_CALL, XREF_JUMP, ...
+ * @param length uint8_t length of the referencing instruction
+ */
+typedef struct XrefStruct {
+    uint16_t from;
+    uint16_t to;
+    uint8_t kind;
+    uint8_t length;
+} Xref;
+
+/**
+ * @brief The references of a text segment, allocated or mapped from a file
+ * @param byFrom Xref* sorted by from, then to
+ * @param byTo Xref* sorted by to, then from
+ * @param count unsigned int
+ * @param capacity unsigned int allocated entries, 0 if mapped
+ * @param map char* the mapped file or NULL
+ * @param mapLen size_t
+ */
+typedef struct XrefTableStruct {
+    Xref *byFrom;
+    Xref *byTo;
+    unsigned int count;
+    unsigned int capacity;
+    char *map;
+    size_t mapLen;
+} XrefTable;
+
+/**
+ * @brief Collect the references of decoded records
+ *
+ * @param img Image*
+ * @param dec DecodedText*
+ * @param xrefs XrefTable* initialized here
+ * @return int 0 on success, 1 on allocation failure
+ */
+int collectXrefs(Image *img, DecodedText *dec, XrefTable *xrefs);
+
+/**
+ * @brief Decode the text of an image and collect its references
+ *
+ * @param img Image*
+ * @param xrefs XrefTable* initialized here
+ * @return int 0 on success, 1 on error
+ */
+int buildXrefs(Image *img, XrefTable *xrefs);
+
+/**
+ * @brief Free an allocated or mapped table
+ *
+ * @param xrefs XrefTable*
+ */
+void freeXrefs(XrefTable *xrefs);
+
+/**
+ * @brief Write an xref file
+ *
+ * @param path const char*
+ * @param xrefs XrefTable*
+ * @param textLen int
+ * @param hash uint64_t imageHash of the executable
+ * @return int 0 on success, 1 on error
+ */
+int writeXrefs(const char *path, XrefTable *xrefs, int textLen, uint64_t hash);
+
+/**
+ * @brief Map an xref file, silently failing if it is missing or stale
+ *
+ * @param path const char*
+ * @param xrefs XrefTable* initialized here
+ * @param textLen int expected
+ * @param hash uint64_t expected
+ * @return int 0 on success, 1 if it has to be rebuilt
+ */
+int mapXrefs(const char *path, XrefTable *xrefs, int textLen, uint64_t hash);
+
+/**
+ * @brief Find the references to an address
+ *
+ * @param xrefs XrefTable*
+ * @param to unsigned int
+ * @param count unsigned int* set to the number of references
+ * @return const Xref* the first of them in byTo
+ */
+const Xref *findXrefsTo(XrefTable *xrefs, unsigned int to, unsigned int *count);
+
+/**
+ * @brief Find the references of the instruction at an offset
+ *
+ * @param xrefs XrefTable*
+ * @param from unsigned int
+ * @param count unsigned int* set to the number of references
+ * @return const Xref* the first of them in byFrom
+ */
+const Xref *findXrefsFrom(XrefTable *xrefs, unsigned int from, unsigned int *count);
+
+/**
+ * @brief dis xref FILE ADDR|SYMBOL : list the instructions referencing an
+ * address, through the xref file next to FILE (built when needed)
+ *
+ * @param path const char*
+ * @param query const char* hexadecimal address or symbol name
+ * @param file FILE*
+ * @return int 0 on success, 1 on error
+ */
+int queryXrefs(const char *path, const char *query, FILE *file);
+
+#endif